@@ -0,0 +1,7 @@
+// Host backend: see loki/host.h.
+#ifndef LOKI_ALLOC_H
+#define LOKI_ALLOC_H
+
+#include <loki/host.h>
+
+#endif // include guard
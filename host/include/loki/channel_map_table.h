@@ -0,0 +1,7 @@
+// Host backend: see loki/host.h.
+#ifndef LOKI_CHANNEL_MAP_TABLE_H
+#define LOKI_CHANNEL_MAP_TABLE_H
+
+#include <loki/host.h>
+
+#endif // include guard
@@ -0,0 +1,7 @@
+// Host backend: see loki/host.h.
+#ifndef LOKI_CHANNELS_H
+#define LOKI_CHANNELS_H
+
+#include <loki/host.h>
+
+#endif // include guard
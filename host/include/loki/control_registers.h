@@ -0,0 +1,7 @@
+// Host backend: see loki/host.h.
+#ifndef LOKI_CONTROL_REGISTERS_H
+#define LOKI_CONTROL_REGISTERS_H
+
+#include <loki/host.h>
+
+#endif // include guard
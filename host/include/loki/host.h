@@ -0,0 +1,96 @@
+// Host-native stand-in for the parts of libloki used by lat-dynamic.
+//
+// Each core of each tile is a pthread. Channels between cores are in-process
+// FIFOs, one per core input channel, and the channel map table is per-thread.
+// Tile 0 core 0 is the thread which calls main().
+//
+// This is not a simulator: there is no notion of credits, network latency or
+// memory banks. Cycle counts are nanoseconds of wall-clock time.
+
+#ifndef LOKI_HOST_H
+#define LOKI_HOST_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Tiles are arranged in a grid 4 tiles wide, filled left to right, top to
+// bottom. Rows and columns are numbered from 1, and the row is held in the
+// bottom 3 bits of the ID.
+#define LOKI_HOST_GRID_WIDTH 4
+#define LOKI_HOST_MAX_TILES (LOKI_HOST_GRID_WIDTH * 7)
+#define LOKI_HOST_CORES_PER_TILE 2
+#define LOKI_HOST_INPUT_CHANNELS 8
+#define LOKI_HOST_OUTPUT_CHANNELS 16
+
+typedef int tile_id_t;
+typedef int channel_t;
+
+enum Component {
+  COMPONENT_CORE_0 = 0,
+  COMPONENT_CORE_1 = 1
+};
+
+#define DEFAULT_CREDIT_COUNT 4
+#define INFINITE_CREDIT_COUNT 0
+
+static inline tile_id_t tile_id(int col, int row) {
+  return (col << 3) | row;
+}
+
+static inline tile_id_t int2tile(int tile) {
+  return tile_id(tile % LOKI_HOST_GRID_WIDTH + 1, tile / LOKI_HOST_GRID_WIDTH + 1);
+}
+
+static inline int tile2int(tile_id_t tile) {
+  return ((tile & 7) - 1) * LOKI_HOST_GRID_WIDTH + (tile >> 3) - 1;
+}
+
+tile_id_t get_tile_id(void);
+int get_core_id(void);
+
+// Address of an input channel of a core. Credits are ignored: all FIFOs are
+// unbounded.
+channel_t loki_core_address(tile_id_t tile, int component, int channel,
+                            int credits);
+
+// Channel map table of the current core.
+void set_channel_map(int entry, channel_t value);
+channel_t get_channel_map(int entry);
+
+// Send to the destination held in the given channel map table entry.
+void loki_send(int channel, int value);
+void loki_send_data(const void* data, size_t size, int channel);
+
+// Receive from one of this core's input channels. Blocks until data arrives.
+int loki_receive(int channel);
+void loki_receive_data(void* data, size_t size, int channel);
+
+// Return whether there is data waiting on an input channel.
+bool loki_test_channel(int channel);
+
+// Memory is shared and coherent, so flushing and invalidating are no-ops.
+static inline void loki_channel_flush_data(int channel, const void* data,
+                                           size_t size) {}
+static inline void loki_channel_invalidate_data(int channel, const void* data,
+                                                size_t size) {}
+
+// Barrier between core 0 of tiles [0, num_tiles).
+void loki_sync_tiles(int num_tiles);
+
+// Execute `func` on the given core, passing a copy of `size` bytes of `data`.
+// Returns immediately unless the target is the current core.
+void loki_remote_execute(tile_id_t tile, int core, void (*func)(const void*),
+                         const void* data, size_t size);
+
+// Start the thread behind a core. Equivalent to sending a core its boot
+// sequence. Starting a core twice has no effect.
+void loki_host_start_core(tile_id_t tile, int core);
+
+unsigned long get_cycle_count(void);
+
+void* loki_malloc(size_t size);
+void loki_free(void* ptr);
+
+#endif // include guard
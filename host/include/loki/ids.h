@@ -0,0 +1,7 @@
+// Host backend: see loki/host.h.
+#ifndef LOKI_IDS_H
+#define LOKI_IDS_H
+
+#include <loki/host.h>
+
+#endif // include guard
@@ -0,0 +1,16 @@
+// Host backend: see loki/host.h.
+#ifndef LOKI_INIT_H
+#define LOKI_INIT_H
+
+#include <loki/host.h>
+
+typedef struct {
+  int cores;
+  int stack_size;
+  channel_t inst_mem;
+  channel_t data_mem;
+  char* stack_pointer;
+  void (*config_func)(void);
+} init_config;
+
+#endif // include guard
@@ -0,0 +1,7 @@
+// Host backend: see loki/host.h.
+#ifndef LOKI_SPAWN_H
+#define LOKI_SPAWN_H
+
+#include <loki/host.h>
+
+#endif // include guard
@@ -0,0 +1,93 @@
+// Host-native stand-in for the parts of lat-nn used by lat-dynamic.
+//
+// All strides are in bytes. As on the accelerator, convolution results are
+// accumulated into the output, so one output can be built up from several
+// calls. The loop nest is accepted for compatibility; the host kernels choose
+// their own loop order based on the tensor layouts.
+
+#ifndef NN_LAYERS_H
+#define NN_LAYERS_H
+
+#include <loki/host.h>
+
+typedef int32_t data_t;
+
+typedef struct {
+  data_t* address;
+  channel_t memory_config;
+} memory_region_t;
+
+typedef struct {
+  memory_region_t data;
+  int channel_stride;
+  int row_stride;
+  int column_stride;
+  int batch_stride;
+} activation_config_t;
+
+typedef struct {
+  memory_region_t data;
+  int in_channel_stride;
+  int out_channel_stride;
+  int row_stride;
+  int column_stride;
+} filter_config_t;
+
+typedef struct {
+  int batch_size;
+  int in_channels;
+  int out_channels;
+  int image_width;
+  int image_height;
+  int filter_width;
+  int filter_height;
+  int groups;
+  int stride;
+  int dilation;
+} conv_shape_t;
+
+typedef struct {
+  int batch_size;
+  int channels;
+  int input_width;
+  int input_height;
+  int window_width;
+  int window_height;
+  int stride;
+} pool_shape_t;
+
+// Filter loops can be input stationary (_IS) or output stationary (_OS).
+enum Loop {
+  BATCH,
+  IN_CHANNELS,
+  OUT_CHANNELS,
+  IMAGE_WIDTH,
+  IMAGE_HEIGHT,
+  FILTER_WIDTH_IS,
+  FILTER_WIDTH_OS,
+  FILTER_HEIGHT_IS,
+  FILTER_HEIGHT_OS
+};
+
+typedef struct {
+  int loop_count;
+  enum Loop* loops;
+} loop_nest_t;
+
+void lat_conv2d(const activation_config_t* input,
+                const filter_config_t* weights,
+                activation_config_t* output,
+                const conv_shape_t* shape,
+                const loop_nest_t* loop_order);
+
+void lat_linear(const activation_config_t* input,
+                const filter_config_t* weights,
+                activation_config_t* output,
+                int batch_size, int in_channels, int out_channels,
+                const loop_nest_t* loop_order);
+
+void lat_max_pool_2d(const activation_config_t* input,
+                     activation_config_t* output,
+                     const pool_shape_t* shape);
+
+#endif // include guard
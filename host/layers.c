@@ -0,0 +1,176 @@
+// Host-native implementation of the lat-nn layers declared in nn/layers.h.
+//
+// Two layouts get fast paths, matching the tensors built in src/alloc.c:
+//  * Channels innermost (dense mode): each output is a dot product over
+//    contiguous input channels.
+//  * Pixels innermost (sparse modes): each filter tap is a scaled row
+//    addition over contiguous pixels.
+// Anything else falls back to a direct strided loop.
+
+#include <loki/host.h>
+#include <nn/layers.h>
+
+#define ELEMENTS(stride) ((stride) / (int)sizeof(data_t))
+
+// out[x] += weight * in[x * stride], for x in [0, width).
+static void scaled_row_add(data_t* restrict out, const data_t* restrict in,
+                           data_t weight, int width, int stride) {
+  if (stride == 1) {
+    for (int x=0; x<width; x++)
+      out[x] += weight * in[x];
+  }
+  else {
+    for (int x=0; x<width; x++)
+      out[x] += weight * in[x * stride];
+  }
+}
+
+// Sum of a[i] * b[i], for i in [0, length).
+static data_t dot_product(const data_t* restrict a, const data_t* restrict b,
+                          int length) {
+  data_t sum = 0;
+  for (int i=0; i<length; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+void lat_conv2d(const activation_config_t* input,
+                const filter_config_t* weights,
+                activation_config_t* output,
+                const conv_shape_t* shape,
+                const loop_nest_t* loop_order) {
+  assert(shape->groups == 1);
+  assert(shape->dilation == 1);
+
+  int out_width = (shape->image_width - shape->filter_width) / shape->stride + 1;
+  int out_height = (shape->image_height - shape->filter_height) / shape->stride + 1;
+
+  // Strides in elements.
+  int in_b = ELEMENTS(input->batch_stride);
+  int in_c = ELEMENTS(input->channel_stride);
+  int in_x = ELEMENTS(input->row_stride);
+  int in_y = ELEMENTS(input->column_stride);
+  int w_i = ELEMENTS(weights->in_channel_stride);
+  int w_o = ELEMENTS(weights->out_channel_stride);
+  int w_x = ELEMENTS(weights->row_stride);
+  int w_y = ELEMENTS(weights->column_stride);
+  int out_b = ELEMENTS(output->batch_stride);
+  int out_c = ELEMENTS(output->channel_stride);
+  int out_x = ELEMENTS(output->row_stride);
+  int out_y = ELEMENTS(output->column_stride);
+
+  int stride = shape->stride;
+
+  for (int b=0; b<shape->batch_size; b++) {
+    const data_t* in_batch = input->data.address + b * in_b;
+    data_t* out_batch = output->data.address + b * out_b;
+
+    if (in_c == 1 && w_i == 1) {
+      for (int y=0; y<out_height; y++) {
+        for (int x=0; x<out_width; x++) {
+          const data_t* in_pixel = in_batch + y * stride * in_y + x * stride * in_x;
+          data_t* out_pixel = out_batch + y * out_y + x * out_x;
+
+          for (int o=0; o<shape->out_channels; o++) {
+            data_t sum = 0;
+            for (int fy=0; fy<shape->filter_height; fy++)
+              for (int fx=0; fx<shape->filter_width; fx++)
+                sum += dot_product(in_pixel + fy * in_y + fx * in_x,
+                                   weights->data.address + o * w_o + fy * w_y + fx * w_x,
+                                   shape->in_channels);
+            out_pixel[o * out_c] += sum;
+          }
+        }
+      }
+    }
+    else if (out_x == 1) {
+      for (int o=0; o<shape->out_channels; o++) {
+        for (int i=0; i<shape->in_channels; i++) {
+          for (int fy=0; fy<shape->filter_height; fy++) {
+            for (int fx=0; fx<shape->filter_width; fx++) {
+              data_t weight = weights->data.address[i * w_i + o * w_o + fy * w_y + fx * w_x];
+              for (int y=0; y<out_height; y++)
+                scaled_row_add(out_batch + o * out_c + y * out_y,
+                               in_batch + i * in_c + (y * stride + fy) * in_y + fx * in_x,
+                               weight, out_width, stride * in_x);
+            }
+          }
+        }
+      }
+    }
+    else {
+      for (int o=0; o<shape->out_channels; o++)
+        for (int y=0; y<out_height; y++)
+          for (int x=0; x<out_width; x++) {
+            data_t sum = 0;
+            for (int i=0; i<shape->in_channels; i++)
+              for (int fy=0; fy<shape->filter_height; fy++)
+                for (int fx=0; fx<shape->filter_width; fx++)
+                  sum += in_batch[i * in_c + (y * stride + fy) * in_y + (x * stride + fx) * in_x]
+                       * weights->data.address[i * w_i + o * w_o + fy * w_y + fx * w_x];
+            out_batch[o * out_c + y * out_y + x * out_x] += sum;
+          }
+    }
+  }
+}
+
+// A linear layer is a 1x1 convolution over a 1x1 image.
+void lat_linear(const activation_config_t* input,
+                const filter_config_t* weights,
+                activation_config_t* output,
+                int batch_size, int in_channels, int out_channels,
+                const loop_nest_t* loop_order) {
+  conv_shape_t shape = {
+    .batch_size = batch_size, .in_channels = in_channels,
+    .out_channels = out_channels, .image_width = 1, .image_height = 1,
+    .filter_width = 1, .filter_height = 1, .groups = 1, .stride = 1,
+    .dilation = 1
+  };
+
+  lat_conv2d(input, weights, output, &shape, loop_order);
+}
+
+void lat_max_pool_2d(const activation_config_t* input,
+                     activation_config_t* output,
+                     const pool_shape_t* shape) {
+  int out_width = (shape->input_width - shape->window_width) / shape->stride + 1;
+  int out_height = (shape->input_height - shape->window_height) / shape->stride + 1;
+
+  int in_b = ELEMENTS(input->batch_stride);
+  int in_c = ELEMENTS(input->channel_stride);
+  int in_x = ELEMENTS(input->row_stride);
+  int in_y = ELEMENTS(input->column_stride);
+  int out_b = ELEMENTS(output->batch_stride);
+  int out_c = ELEMENTS(output->channel_stride);
+  int out_x = ELEMENTS(output->row_stride);
+  int out_y = ELEMENTS(output->column_stride);
+
+  for (int b=0; b<shape->batch_size; b++) {
+    for (int c=0; c<shape->channels; c++) {
+      const data_t* in_channel = input->data.address + b * in_b + c * in_c;
+      data_t* out_channel = output->data.address + b * out_b + c * out_c;
+
+      for (int y=0; y<out_height; y++) {
+        for (int x=0; x<out_width; x++) {
+          const data_t* window = in_channel + y * shape->stride * in_y
+                                            + x * shape->stride * in_x;
+          data_t max = window[0];
+
+          for (int wy=0; wy<shape->window_height; wy++) {
+            const data_t* row = window + wy * in_y;
+            if (in_x == 1) {
+              for (int wx=0; wx<shape->window_width; wx++)
+                max = (row[wx] > max) ? row[wx] : max;
+            }
+            else {
+              for (int wx=0; wx<shape->window_width; wx++)
+                max = (row[wx * in_x] > max) ? row[wx * in_x] : max;
+            }
+          }
+
+          out_channel[y * out_y + x * out_x] = max;
+        }
+      }
+    }
+  }
+}
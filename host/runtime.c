@@ -0,0 +1,323 @@
+// Host-native implementation of the libloki functions declared in loki/host.h.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <loki/host.h>
+
+// Unbounded FIFO of words. Protected by the owning core's lock.
+typedef struct {
+  int* data;
+  size_t capacity;
+  size_t head;
+  size_t count;
+} fifo_t;
+
+// A function waiting to be executed by a core.
+typedef struct job {
+  void (*func)(const void*);
+  void* args;
+  struct job* next;
+} job_t;
+
+typedef struct {
+  tile_id_t tile;
+  int core;
+
+  pthread_t thread;
+  bool started;
+
+  pthread_mutex_t lock;
+  pthread_cond_t data_arrived;
+
+  fifo_t inputs[LOKI_HOST_INPUT_CHANNELS];
+  job_t* jobs;
+  job_t* last_job;
+} core_t;
+
+static core_t cores[LOKI_HOST_MAX_TILES][LOKI_HOST_CORES_PER_TILE];
+static pthread_once_t cores_initialised = PTHREAD_ONCE_INIT;
+
+// The core which the current thread represents. NULL for the main thread,
+// which is tile 0 core 0.
+static __thread core_t* this_core = NULL;
+static __thread channel_t channel_map[LOKI_HOST_OUTPUT_CHANNELS];
+
+static void init_cores(void) {
+  for (int tile=0; tile<LOKI_HOST_MAX_TILES; tile++) {
+    for (int core=0; core<LOKI_HOST_CORES_PER_TILE; core++) {
+      core_t* c = &cores[tile][core];
+      c->tile = int2tile(tile);
+      c->core = core;
+      pthread_mutex_init(&c->lock, NULL);
+      pthread_cond_init(&c->data_arrived, NULL);
+    }
+  }
+
+  cores[0][0].started = true;
+}
+
+static core_t* get_core(tile_id_t tile, int core) {
+  pthread_once(&cores_initialised, init_cores);
+
+  int index = tile2int(tile);
+  if (index < 0 || index >= LOKI_HOST_MAX_TILES ||
+      core < 0 || core >= LOKI_HOST_CORES_PER_TILE) {
+    fprintf(stderr, "Error: no core %d on tile %d (host backend supports %d tiles)\n",
+            core, index, LOKI_HOST_MAX_TILES);
+    exit(1);
+  }
+
+  return &cores[index][core];
+}
+
+static core_t* current_core(void) {
+  if (this_core == NULL)
+    this_core = get_core(int2tile(0), 0);
+  return this_core;
+}
+
+tile_id_t get_tile_id(void) {
+  return current_core()->tile;
+}
+
+int get_core_id(void) {
+  return current_core()->core;
+}
+
+
+// Channels.
+
+// A channel address holds the destination tile, core and input channel.
+channel_t loki_core_address(tile_id_t tile, int component, int channel,
+                            int credits) {
+  assert(channel >= 0 && channel < LOKI_HOST_INPUT_CHANNELS);
+  return (tile << 8) | (component << 4) | channel;
+}
+
+void set_channel_map(int entry, channel_t value) {
+  assert(entry >= 0 && entry < LOKI_HOST_OUTPUT_CHANNELS);
+  channel_map[entry] = value;
+}
+
+channel_t get_channel_map(int entry) {
+  assert(entry >= 0 && entry < LOKI_HOST_OUTPUT_CHANNELS);
+  return channel_map[entry];
+}
+
+static void fifo_push(fifo_t* fifo, const int* data, size_t count) {
+  if (fifo->count + count > fifo->capacity) {
+    size_t capacity = fifo->capacity ? fifo->capacity : 16;
+    while (capacity < fifo->count + count)
+      capacity *= 2;
+
+    int* grown = malloc(capacity * sizeof(int));
+    assert(grown != NULL);
+    for (size_t i=0; i<fifo->count; i++)
+      grown[i] = fifo->data[(fifo->head + i) % fifo->capacity];
+
+    free(fifo->data);
+    fifo->data = grown;
+    fifo->capacity = capacity;
+    fifo->head = 0;
+  }
+
+  for (size_t i=0; i<count; i++)
+    fifo->data[(fifo->head + fifo->count + i) % fifo->capacity] = data[i];
+  fifo->count += count;
+}
+
+static int fifo_pop(fifo_t* fifo) {
+  int value = fifo->data[fifo->head];
+  fifo->head = (fifo->head + 1) % fifo->capacity;
+  fifo->count--;
+  return value;
+}
+
+// Send whole words to the destination in the given channel map table entry.
+static void send_words(const int* data, size_t count, int channel) {
+  channel_t address = get_channel_map(channel);
+  core_t* target = get_core(address >> 8, (address >> 4) & 0xf);
+  fifo_t* fifo = &target->inputs[address & 0xf];
+
+  pthread_mutex_lock(&target->lock);
+  fifo_push(fifo, data, count);
+  pthread_cond_broadcast(&target->data_arrived);
+  pthread_mutex_unlock(&target->lock);
+}
+
+void loki_send(int channel, int value) {
+  send_words(&value, 1, channel);
+}
+
+void loki_send_data(const void* data, size_t size, int channel) {
+  size_t words = (size + sizeof(int) - 1) / sizeof(int);
+  int buffer[words];
+  memcpy(buffer, data, size);
+  send_words(buffer, words, channel);
+}
+
+static void receive_words(int* data, size_t count, int channel) {
+  assert(channel >= 0 && channel < LOKI_HOST_INPUT_CHANNELS);
+  core_t* core = current_core();
+  fifo_t* fifo = &core->inputs[channel];
+
+  pthread_mutex_lock(&core->lock);
+  for (size_t i=0; i<count; i++) {
+    while (fifo->count == 0)
+      pthread_cond_wait(&core->data_arrived, &core->lock);
+    data[i] = fifo_pop(fifo);
+  }
+  pthread_mutex_unlock(&core->lock);
+}
+
+int loki_receive(int channel) {
+  int value;
+  receive_words(&value, 1, channel);
+  return value;
+}
+
+void loki_receive_data(void* data, size_t size, int channel) {
+  size_t words = (size + sizeof(int) - 1) / sizeof(int);
+  int buffer[words];
+  receive_words(buffer, words, channel);
+  memcpy(data, buffer, size);
+}
+
+// Cores often poll in a loop, so give up the processor if there's nothing to
+// see. This stops polling cores starving the others when there are more tiles
+// than host CPUs.
+bool loki_test_channel(int channel) {
+  assert(channel >= 0 && channel < LOKI_HOST_INPUT_CHANNELS);
+  core_t* core = current_core();
+
+  pthread_mutex_lock(&core->lock);
+  bool waiting = core->inputs[channel].count > 0;
+  pthread_mutex_unlock(&core->lock);
+
+  if (!waiting)
+    sched_yield();
+
+  return waiting;
+}
+
+
+// Synchronisation.
+
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sync_done = PTHREAD_COND_INITIALIZER;
+static int sync_arrived = 0;
+static unsigned long sync_generation = 0;
+
+void loki_sync_tiles(int num_tiles) {
+  pthread_mutex_lock(&sync_lock);
+
+  unsigned long generation = sync_generation;
+  if (++sync_arrived == num_tiles) {
+    sync_arrived = 0;
+    sync_generation++;
+    pthread_cond_broadcast(&sync_done);
+  }
+  else {
+    while (generation == sync_generation)
+      pthread_cond_wait(&sync_done, &sync_lock);
+  }
+
+  pthread_mutex_unlock(&sync_lock);
+}
+
+
+// Execution.
+
+// Each started core sleeps until it is given a function to execute.
+static void* core_main(void* data) {
+  core_t* core = (core_t*)data;
+  this_core = core;
+
+  while (true) {
+    pthread_mutex_lock(&core->lock);
+    while (core->jobs == NULL)
+      pthread_cond_wait(&core->data_arrived, &core->lock);
+
+    job_t* job = core->jobs;
+    core->jobs = job->next;
+    if (core->jobs == NULL)
+      core->last_job = NULL;
+    pthread_mutex_unlock(&core->lock);
+
+    job->func(job->args);
+    free(job->args);
+    free(job);
+  }
+
+  return NULL;
+}
+
+void loki_host_start_core(tile_id_t tile, int core) {
+  core_t* c = get_core(tile, core);
+
+  pthread_mutex_lock(&c->lock);
+  if (!c->started) {
+    int error = pthread_create(&c->thread, NULL, core_main, c);
+    if (error) {
+      fprintf(stderr, "Error: unable to start core %d on tile %d\n",
+              core, tile2int(tile));
+      exit(1);
+    }
+    pthread_detach(c->thread);
+    c->started = true;
+  }
+  pthread_mutex_unlock(&c->lock);
+}
+
+void loki_remote_execute(tile_id_t tile, int core, void (*func)(const void*),
+                         const void* data, size_t size) {
+  core_t* target = get_core(tile, core);
+
+  if (target == current_core()) {
+    func(data);
+    return;
+  }
+
+  job_t* job = malloc(sizeof(job_t));
+  assert(job != NULL);
+  job->func = func;
+  job->args = malloc(size ? size : 1);
+  assert(job->args != NULL);
+  memcpy(job->args, data, size);
+  job->next = NULL;
+
+  // Cores which were not started by init() are started on demand.
+  loki_host_start_core(tile, core);
+
+  pthread_mutex_lock(&target->lock);
+  if (target->last_job == NULL)
+    target->jobs = job;
+  else
+    target->last_job->next = job;
+  target->last_job = job;
+  pthread_cond_broadcast(&target->data_arrived);
+  pthread_mutex_unlock(&target->lock);
+}
+
+
+// Miscellaneous.
+
+unsigned long get_cycle_count(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long)now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+// Memory is zeroed so that results are repeatable.
+void* loki_malloc(size_t size) {
+  return calloc(1, size);
+}
+
+void loki_free(void* ptr) {
+  free(ptr);
+}
@@ -0,0 +1,164 @@
+#!/bin/bash
+# Performance regression check: run every case in a list, and compare its
+# fastest time and output checksum against a budgets file. The fastest of
+# several runs is used because it is the least affected by noise.
+#
+# Usage: perf/check.sh [--update] program cases budgets
+#
+# Each line of the budgets file is:
+#   arguments | budget | tolerance (%) | checksum
+#
+# A case fails if it has no budget, the program fails, the checksum differs,
+# or the fastest time exceeds the budget by more than the tolerance. Cases
+# run with --reference=1 also fail if the output checksum differs from the
+# naive reference convolution's, even when updating.
+# With --update, the budgets file is rewritten with the measured times and
+# checksums instead, keeping any existing tolerances. Each case is measured
+# several times, and the slowest result kept, so that a lucky measurement
+# doesn't give a budget which is hard to meet.
+#
+# Environment:
+#   RUN        command to run the program with (e.g. lokisim and its options)
+#   REPEATS    timed runs per case (default 7), after one warm-up run
+#   TOLERANCE  tolerance for new budgets, as a percentage (default 50)
+
+update=0
+if [ "$1" = "--update" ]; then
+  update=1
+  shift
+fi
+
+if [ $# -ne 3 ]; then
+  echo "Usage: $0 [--update] program cases budgets"
+  exit 2
+fi
+
+program=$1
+cases=$2
+budgets=$3
+repeats=${REPEATS:-7}
+default_tolerance=${TOLERANCE:-50}
+update_rounds=3
+
+if [ $update -eq 0 ] && [ ! -f "$budgets" ]; then
+  echo "No budgets for this backend: $budgets does not exist."
+  echo "Create it with make perf-update, or choose another backend (e.g. BACKEND=host)."
+  exit 2
+fi
+
+trim() {
+  local text=$1
+  text=${text#"${text%%[![:space:]]*}"}
+  text=${text%"${text##*[![:space:]]}"}
+  echo "$text"
+}
+
+# Print the field ($2: 2=budget, 3=tolerance, 4=checksum) for arguments $1.
+lookup() {
+  [ -f "$budgets" ] || return
+  while IFS='|' read -r args budget tolerance checksum; do
+    if [ "$(trim "$args")" = "$1" ]; then
+      case $2 in
+        2) trim "$budget" ;;
+        3) trim "$tolerance" ;;
+        4) trim "$checksum" ;;
+      esac
+      return
+    fi
+  done < "$budgets"
+}
+
+total=0
+failed=0
+new_budgets=""
+
+while read -r line; do
+  line=$(trim "$line")
+  case $line in
+    ""|"#"*) continue ;;
+  esac
+
+  total=$((total + 1))
+  args=$line
+
+  rounds=1
+  [ $update -eq 1 ] && rounds=$update_rounds
+
+  cycles=0
+  for ((round=0; round<rounds; round++)); do
+    # Local loop nest tuning would change the timings.
+    output=$($RUN $program $args --repeats=$repeats --warmup=1 --checksum=1 \
+             --loop-nests=/dev/null 2>&1)
+    status=$?
+
+    fastest=$(echo "$output" | sed -n 's/^Median [0-9]*, min \([0-9]*\),.*/\1/p')
+    checksum=$(echo "$output" | sed -n 's/^Output checksum \([0-9a-f]*\)/\1/p')
+    reference=$(echo "$output" | sed -n 's/^Reference checksum \([0-9a-f]*\)/\1/p')
+
+    if [ $status -ne 0 ] || [ -z "$fastest" ] || [ -z "$checksum" ]; then
+      break
+    fi
+
+    [ $fastest -gt $cycles ] && cycles=$fastest
+  done
+
+  if [ $status -ne 0 ] || [ -z "$fastest" ] || [ -z "$checksum" ]; then
+    echo "FAIL  $args: program failed (exit status $status)"
+    echo "$output" | tail -5 | sed 's/^/      /'
+    failed=$((failed + 1))
+    continue
+  fi
+
+  if [ -n "$reference" ] && [ "$checksum" != "$reference" ]; then
+    echo "FAIL  $args: wrong output (checksum $checksum, reference $reference)"
+    failed=$((failed + 1))
+    continue
+  fi
+
+  budget=$(lookup "$args" 2)
+  tolerance=$(lookup "$args" 3)
+  expected=$(lookup "$args" 4)
+
+  if [ $update -eq 1 ]; then
+    new_budgets+="$args | $cycles | ${tolerance:-$default_tolerance} | $checksum"$'\n'
+    echo "      $args: $cycles"
+    continue
+  fi
+
+  if [ -z "$budget" ]; then
+    echo "FAIL  $args: no budget (run make perf-update)"
+    failed=$((failed + 1))
+  elif [ "$checksum" != "$expected" ]; then
+    echo "FAIL  $args: wrong output (checksum $checksum, expected $expected)"
+    failed=$((failed + 1))
+  elif [ $((cycles * 100)) -gt $((budget * (100 + tolerance))) ]; then
+    echo "FAIL  $args: $cycles cycles, budget $budget +$tolerance%"
+    failed=$((failed + 1))
+  elif [ $((cycles * 100)) -lt $((budget * (100 - tolerance))) ]; then
+    echo "ok    $args: $cycles cycles, well under budget $budget (consider make perf-update)"
+  else
+    echo "ok    $args: $cycles cycles, budget $budget"
+  fi
+done < "$cases"
+
+if [ $update -eq 1 ]; then
+  if [ $failed -gt 0 ]; then
+    echo "Not updating $budgets: $failed of $total cases failed"
+    exit 1
+  fi
+
+  {
+    echo "# Budgets for perf/cases.txt, written by make perf-update."
+    echo "# arguments | fastest cycles | tolerance (%) | output checksum"
+    printf "%s" "$new_budgets"
+  } > "$budgets"
+  echo "Updated $budgets"
+  exit 0
+fi
+
+if [ $failed -gt 0 ]; then
+  echo "*** PERFORMANCE CHECK FAILED: $failed of $total cases ***"
+  exit 1
+fi
+
+echo "Performance check passed: $total cases"
@@ -0,0 +1,75 @@
+#!/bin/bash
+# Stress test for the load balancing server (--lb-server=1). Core 1 gives work
+# away while core 0 claims it, so mistakes only show up under particular
+# interleavings. Each case is run many times with the server, and its output
+# checksum compared with the same layer computed without it.
+#
+# The cases use many small groups of output channels, and images tall enough
+# to be split into bands of rows, so core 0 often starts a new group while
+# core 1 is splitting. They share work by output channel, as tasks with
+# partial sums are never split. On the host, `make stress-check` builds the
+# program with LB_STRESS, which pauses both cores at random in the middle of
+# claims and splits: even with one CPU, the threads then interleave there.
+#
+# Usage: perf/stress.sh program
+#
+# Environment:
+#   RUN      command to run the program with (e.g. lokisim and its options)
+#   ROUNDS   runs of each case (default 100), each of several repeats
+
+if [ $# -ne 1 ]; then
+  echo "Usage: $0 program"
+  exit 2
+fi
+
+program=$1
+rounds=${ROUNDS:-100}
+
+cases=(
+  "16 64 50 16 50 3 --mode=simple --tiles=8 --partition=out"
+  "16 96 50 8 50 3 --mode=simple --tiles=8 --partition=out"
+  "32 64 50 48 50 3 --mode=adaptive --tiles=6 --partition=out"
+  "32 64 50 48 50 3 --mode=hybrid --tiles=5 --weight-block=4 --partition=out"
+  "16 48 50 8 50 3 --mode=simple --tiles=8 --partition=out"
+  "32 24 50 64 50 3 --mode=gather --tiles=4"
+)
+
+checksum() {
+  $RUN $program "$@" --checksum=1 --loop-nests=/dev/null 2>&1 |
+    sed -n 's/^Output checksum \([0-9a-f]*\)/\1/p'
+}
+
+total=0
+failed=0
+
+for args in "${cases[@]}"; do
+  total=$((total + 1))
+  expected=$(checksum $args --lb-server=0)
+
+  if [ -z "$expected" ]; then
+    echo "FAIL  $args: program failed without the server"
+    failed=$((failed + 1))
+    continue
+  fi
+
+  bad=0
+  for ((round=0; round<rounds; round++)); do
+    # Every repeat computes the layer again from scratch.
+    got=$(checksum $args --lb-server=1 --repeats=5)
+    [ "$got" != "$expected" ] && bad=$((bad + 1))
+  done
+
+  if [ $bad -gt 0 ]; then
+    echo "FAIL  $args: wrong output in $bad of $rounds runs (expected $expected)"
+    failed=$((failed + 1))
+  else
+    echo "ok    $args: $rounds runs"
+  fi
+done
+
+if [ $failed -gt 0 ]; then
+  echo "*** STRESS TEST FAILED: $failed of $total cases ***"
+  exit 1
+fi
+
+echo "Stress test passed: $total cases"
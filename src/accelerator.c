@@ -0,0 +1,138 @@
+// Asynchronous convolutions.
+//
+// lat_conv2d blocks until the accelerator finishes. To let core 0 do other
+// work in the meantime, it can hand convolutions to core 1 on the same tile,
+// which issues them and reports back when each one completes. Up to
+// CONV_QUEUE_DEPTH convolutions can be queued, so core 1 can start the next
+// one as soon as the current one finishes, while core 0 prepares more.
+//
+// Command = pointer to a conv_command_t (NULL to stop the server).
+// Completion = one word. One more is sent once the server has stopped.
+
+#include <loki/channels.h>
+#include <loki/channel_io.h>
+#include <loki/channel_map_table.h>
+#include <loki/control_registers.h>
+#include <loki/ids.h>
+#include <loki/spawn.h>
+#include <nn/layers.h>
+#include "defs.h"
+
+#define ACCELERATOR_COMMAND_CHANNEL 4 // on core 1
+#define ACCELERATOR_DONE_CHANNEL 3    // on core 0
+
+// Channel map table entry used by both cores to talk to each other.
+#define ACCELERATOR_OUTPUT 3
+
+// Channel pairs in a convolution, to label it in traces.
+static int conv_size(const conv_shape_t* shape) {
+  return shape->in_channels * shape->out_channels;
+}
+
+// Function executed by core 1 of every tile which uses asynchronous
+// convolutions.
+static void accelerator_server(const void* unused) {
+  channel_t core_0 = loki_core_address(get_tile_id(), COMPONENT_CORE_0,
+                                       ACCELERATOR_DONE_CHANNEL, DEFAULT_CREDIT_COUNT);
+  set_channel_map(ACCELERATOR_OUTPUT, core_0);
+
+  while (true) {
+    conv_command_t* command;
+    loki_receive_data(&command, sizeof(command), ACCELERATOR_COMMAND_CHANNEL);
+
+    if (command == NULL)
+      break;
+
+    unsigned long start = get_cycle_count();
+    lat_conv2d(&command->input, &command->weights, &command->output,
+               &command->shape, command->loop_nest);
+    trace_complete("lat_conv2d", start, conv_size(&command->shape));
+    loki_send(ACCELERATOR_OUTPUT, 1);
+  }
+
+  flush_trace();
+  loki_send(ACCELERATOR_OUTPUT, 0);
+}
+
+void init_conv_queue(conv_queue_t* queue, bool async) {
+  queue->async = async;
+  queue->outstanding = 0;
+  queue->next_slot = 0;
+
+  if (async) {
+    loki_remote_execute(get_tile_id(), 1, &accelerator_server, NULL, 0);
+
+    channel_t core_1 = loki_core_address(get_tile_id(), COMPONENT_CORE_1,
+                                         ACCELERATOR_COMMAND_CHANNEL, DEFAULT_CREDIT_COUNT);
+    set_channel_map(ACCELERATOR_OUTPUT, core_1);
+  }
+}
+
+void delete_conv_queue(conv_queue_t* queue) {
+  conv_wait(queue);
+
+  if (queue->async) {
+    const conv_command_t* stop = NULL;
+    loki_send_data(&stop, sizeof(stop), ACCELERATOR_OUTPUT);
+    loki_receive(ACCELERATOR_DONE_CHANNEL);
+  }
+}
+
+void conv_submit(conv_queue_t* queue, conv_command_t* command) {
+  if (queue->async) {
+    // Slots are used in order, and convolutions complete in order, so the
+    // next slot is free once there is space in the queue.
+    conv_wait_for_space(queue);
+
+    conv_command_t* slot = &queue->slots[queue->next_slot];
+    *slot = *command;
+    queue->next_slot = (queue->next_slot + 1) % CONV_QUEUE_DEPTH;
+
+    loki_send_data(&slot, sizeof(slot), ACCELERATOR_OUTPUT);
+    queue->outstanding++;
+    trace_instant("Issue conv", conv_size(&command->shape));
+  }
+  else {
+    unsigned long start = get_cycle_count();
+    lat_conv2d(&command->input, &command->weights, &command->output,
+               &command->shape, command->loop_nest);
+    trace_complete("lat_conv2d", start, conv_size(&command->shape));
+  }
+}
+
+// Collect any completions which have arrived.
+static void check_completions(conv_queue_t* queue) {
+  while (queue->outstanding > 0 && loki_test_channel(ACCELERATOR_DONE_CHANNEL)) {
+    loki_receive(ACCELERATOR_DONE_CHANNEL);
+    queue->outstanding--;
+  }
+}
+
+bool conv_queue_full(conv_queue_t* queue) {
+  check_completions(queue);
+  return queue->outstanding == CONV_QUEUE_DEPTH;
+}
+
+void conv_wait_for_space(conv_queue_t* queue) {
+  if (queue->outstanding < CONV_QUEUE_DEPTH)
+    return;
+
+  unsigned long start = get_cycle_count();
+  while (queue->outstanding >= CONV_QUEUE_DEPTH) {
+    loki_receive(ACCELERATOR_DONE_CHANNEL);
+    queue->outstanding--;
+  }
+  trace_complete("Wait for accelerator", start, 0);
+}
+
+void conv_wait(conv_queue_t* queue) {
+  if (queue->outstanding == 0)
+    return;
+
+  unsigned long start = get_cycle_count();
+  while (queue->outstanding > 0) {
+    loki_receive(ACCELERATOR_DONE_CHANNEL);
+    queue->outstanding--;
+  }
+  trace_complete("Wait for accelerator", start, 0);
+}
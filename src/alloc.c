@@ -1,8 +1,21 @@
+#include <string.h>
 #include <loki/alloc.h>
 #include "defs.h"
 
 // An array of random numbers.
-extern int* random;
+extern int random_numbers[];
+
+// Fill an array with small pseudo-random values in [-8, 8).
+// xorshift is cheap enough to use in simulation, unlike rand().
+void fill_random(data_t* data, int count) {
+  unsigned int state = 0x2545f491;
+  for (int i=0; i<count; i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    data[i] = (data_t)(state >> 28) - 8;
+  }
+}
 
 // Create an activation tensor. Allocation of data and assignment to a memory
 // group is not done. (User must set `address` and `data.memory_config`.)
@@ -24,7 +37,7 @@ void init_weights(filter_config_t* f, int in_channels, int out_channels,
                   int filter_height, int filter_width) {
   f->in_channel_stride = sizeof(data_t);
   f->out_channel_stride = in_channels * f->in_channel_stride;
-  f->row_stride = in_channels * f->out_channel_stride;
+  f->row_stride = out_channels * f->out_channel_stride;
   f->column_stride = filter_width * f->row_stride;
 }
 
@@ -39,6 +52,8 @@ void init_sparse(sparse_activations_t* a,
   a->dense.channel_stride = height * a->dense.column_stride;
   a->dense.batch_stride = channels * a->dense.channel_stride;
   a->num_channels = channels;
+  a->bitmap = NULL;
+  a->offset = 0;
 }
 
 // Create a weight tensor. Allocation of data and assignment to a memory
@@ -53,6 +68,35 @@ void init_weights_sparse(filter_config_t* f, int in_channels, int out_channels,
   f->in_channel_stride = out_channels * f->out_channel_stride;
 }
 
+// Optionally blocked version of init_weights_sparse: see weight_blocks_t.
+// Blocks are ordered by output block, then input block, and each is OIHW.
+// Partial blocks at the edges are padded to full size. Return the number of
+// elements to allocate.
+int init_weights_blocked(filter_config_t* f, weight_blocks_t* blocks,
+                         int block_size, int in_channels, int out_channels,
+                         int filter_height, int filter_width) {
+  blocks->block_size = block_size;
+
+  if (block_size == 0) {
+    blocks->in_block_stride = 0;
+    blocks->out_block_stride = 0;
+    init_weights_sparse(f, in_channels, out_channels, filter_height, filter_width);
+    return in_channels * out_channels * filter_height * filter_width;
+  }
+
+  int in_blocks = (in_channels + block_size - 1) / block_size;
+  int out_blocks = (out_channels + block_size - 1) / block_size;
+
+  f->row_stride = sizeof(data_t);
+  f->column_stride = filter_width * f->row_stride;
+  f->in_channel_stride = filter_height * f->column_stride;
+  f->out_channel_stride = block_size * f->in_channel_stride;
+  blocks->in_block_stride = block_size * f->out_channel_stride;
+  blocks->out_block_stride = in_blocks * blocks->in_block_stride;
+
+  return out_blocks * blocks->out_block_stride / sizeof(data_t);
+}
+
 
 void* init_dense_buffers(const conv_shape_t* shape) {
   // Create some memory groups, allowing data to be physically partitioned.
@@ -110,7 +154,21 @@ void delete_dense_buffers(void* data) {
   loki_free(d);
 }
 
-void* init_sparse_buffers(const conv_shape_t* shape, int in_sparsity) {
+// Zero an output tensor of `channels` channels, so that the next run doesn't
+// accumulate onto the last one's results.
+static void reset_output(activation_config_t* output, int channels, int size) {
+  memset(output->data.address, 0, channels * size * size * sizeof(data_t));
+  loki_channel_flush_data(1, output->data.address,
+                          channels * size * size * sizeof(data_t));
+}
+
+void reset_dense_buffers(void* data, const conv_shape_t* shape) {
+  dense_buffers_t* d = (dense_buffers_t*)data;
+  int out_size = shape->image_width - shape->filter_width + 1;
+  reset_output(&d->output, shape->out_channels, out_size);
+}
+
+void* init_sparse_buffers(const conv_shape_t* shape, const test_options_t* options) {
   // A pre-allocated array of random numbers is used to choose which channels to
   // skip over. (Generating random numbers is expensive to simulate.)
   assert(shape->in_channels + shape->out_channels < 5000);
@@ -122,8 +180,11 @@ void* init_sparse_buffers(const conv_shape_t* shape, int in_sparsity) {
   // or data is compressed.
   data_t* input_ptr = loki_malloc(shape->in_channels * shape->image_width *
                                   shape->image_height * sizeof(data_t));
-  data_t* weight_ptr = loki_malloc(shape->in_channels * shape->out_channels *
-                                   shape->filter_width * shape->filter_height * sizeof(data_t));
+  int weight_count = init_weights_blocked(&(data->weights), &(data->weight_blocks),
+                                          options->weight_block_size,
+                                          shape->in_channels, shape->out_channels,
+                                          shape->filter_height, shape->filter_width);
+  data_t* weight_ptr = loki_malloc(weight_count * sizeof(data_t));
 
   // Simple but inefficient approach: statically allocate maximum possible
   // buffer size. Assuming square input/output.
@@ -140,18 +201,29 @@ void* init_sparse_buffers(const conv_shape_t* shape, int in_sparsity) {
   int in_channels_count = 0;
   int* in_channels_used = loki_malloc(shape->in_channels * sizeof(int));
   for (int i=0; i<shape->in_channels; i++)
-    if (random[i] > in_sparsity)
+    if (random_numbers[i] > options->in_sparsity)
       in_channels_used[in_channels_count++] = i;
 
   init_sparse(&(data->input), shape->batch_size, in_channels_count, shape->image_height, shape->image_width);
   data->input.dense.data.address = input_ptr;
   data->input.channels = in_channels_used;
 
+  channel_bitmap_t* in_bitmap = loki_malloc(sizeof(channel_bitmap_t));
+  assert(in_bitmap != NULL);
+  init_channel_bitmap(in_bitmap, in_channels_used, in_channels_count,
+                      shape->in_channels);
+  data->input.bitmap = in_bitmap;
+
+  init_channel_runs(&data->input_runs, &data->input, 0, in_channels_count);
+  loki_channel_flush_data(1, data->input_runs.runs,
+                          data->input_runs.num_runs * sizeof(channel_run_t));
+
   init_sparse(&(data->input_downsampled), shape->batch_size, in_channels_count, 1, 1);
   data_t* downsampled_ptr = loki_malloc(in_channels_count * sizeof(data_t));
   assert(downsampled_ptr != NULL);
   data->input_downsampled.dense.data.address = downsampled_ptr;
   data->input_downsampled.channels = data->input.channels;
+  data->input_downsampled.bitmap = data->input.bitmap;
 
   // The auxiliary computation is dense and independent of the data.
   // TODO: use a linear layer when available.
@@ -163,7 +235,14 @@ void* init_sparse_buffers(const conv_shape_t* shape, int in_sparsity) {
   };
   data->auxiliary = init_dense_buffers(&aux);
 
-  init_weights_sparse(&(data->weights), shape->in_channels, shape->out_channels, shape->filter_height, shape->filter_width);
+  // Gating decisions depend on the data, so it can no longer be left
+  // uninitialised.
+  if (options->gating != GATING_RANDOM) {
+    fill_random(input_ptr, in_channels_count * shape->image_width * shape->image_height);
+    fill_random(data->auxiliary->weights.data.address,
+                shape->in_channels * shape->out_channels);
+  }
+
   data->weights.data.address = weight_ptr;
 
   init_sparse(&(data->output), shape->batch_size, shape->out_channels, out_size, out_size);
@@ -171,6 +250,14 @@ void* init_sparse_buffers(const conv_shape_t* shape, int in_sparsity) {
   data->output.channels = loki_malloc(shape->out_channels * sizeof(int));
   assert(data->output.channels != NULL);
 
+  // Partial sum buffers are only allocated by tiles which need them.
+  data->num_partial_sums = options->num_tiles;
+  data->partial_sums = loki_malloc(options->num_tiles * sizeof(data_t*));
+  assert(data->partial_sums != NULL);
+  for (int tile=0; tile<options->num_tiles; tile++)
+    data->partial_sums[tile] = NULL;
+  loki_channel_flush_data(1, data->partial_sums, options->num_tiles * sizeof(data_t*));
+
   // Memory management.
   channel_t mem_group_cpu = get_channel_map(1);
   channel_t mem_group_1 = mem_group_cpu; // TODO: use something specific
@@ -198,6 +285,13 @@ void* init_sparse_buffers(const conv_shape_t* shape, int in_sparsity) {
   return data;
 }
 
+void reset_sparse_buffers(void* data, const conv_shape_t* shape) {
+  sparse_buffers_t* d = (sparse_buffers_t*)data;
+  int out_size = shape->image_width - shape->filter_width + 1;
+  reset_output(&d->output.dense, shape->out_channels, out_size);
+  reset_output(&d->auxiliary->output, shape->out_channels, 1);
+}
+
 void delete_sparse_buffers(void* data) {
   sparse_buffers_t* d = (sparse_buffers_t*)data;
 
@@ -209,6 +303,19 @@ void delete_sparse_buffers(void* data) {
   loki_free(d->input.channels);
   loki_free(d->output.channels);
 
+  // Other tiles may have allocated buffers.
+  loki_channel_invalidate_data(1, d->partial_sums,
+                               d->num_partial_sums * sizeof(data_t*));
+  for (int tile=0; tile<d->num_partial_sums; tile++)
+    loki_free(d->partial_sums[tile]);
+  loki_free(d->partial_sums);
+
+  delete_channel_runs(&d->input_runs);
+
+  channel_bitmap_t* in_bitmap = (channel_bitmap_t*)d->input.bitmap;
+  delete_channel_bitmap(in_bitmap);
+  loki_free(in_bitmap);
+
   delete_dense_buffers(d->auxiliary);
 
   loki_free(d);
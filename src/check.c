@@ -0,0 +1,174 @@
+// Checking results.
+//
+// Normally the weights and activations are left uninitialised, since their
+// values don't affect performance. To check that a change hasn't altered the
+// results, they can be filled with known values instead, and the outputs
+// summarised as a checksum.
+//
+// Every value depends only on its logical position (channel, filter, pixel),
+// never on where it is stored, so the checksum is the same for every sparse
+// mode, tile count and weight layout. Only output channels which were
+// computed contribute.
+//
+// The checksum can also be computed from a naive convolution of the known
+// values, without reading the inputs, weights or outputs held in memory. This
+// checks the computation itself, rather than its consistency between modes.
+
+#include <loki/channels.h>
+#include "defs.h"
+
+// Small pseudo-random value in [-8, 8) for logical position (a, b, c).
+static data_t test_value(unsigned int a, unsigned int b, unsigned int c) {
+  unsigned int hash = a * 0x9e3779b1u + b * 0x85ebca77u + c * 0xc2b2ae3du;
+  hash ^= hash >> 15;
+  hash *= 0x2c1b3c6du;
+  hash ^= hash >> 12;
+  return (data_t)(hash % 16) - 8;
+}
+
+// Address of pixel (x, y) of channel `c` of an activation tensor. The `row`
+// stride moves along a row (x), and the `column` stride down a column (y).
+static data_t* activation_element(const activation_config_t* a, int c, int x, int y) {
+  return a->data.address + (c * a->channel_stride + x * a->row_stride +
+                            y * a->column_stride) / sizeof(data_t);
+}
+
+// Fill `num_channels` channels of an activation tensor. Channel `c` is
+// logically channel `channels[c]`, or `c` if `channels` is NULL.
+static void fill_activations(const activation_config_t* a, const int* channels,
+                             int num_channels, int width, int height) {
+  for (int c=0; c<num_channels; c++) {
+    int channel = (channels == NULL) ? c : channels[c];
+    for (int y=0; y<height; y++)
+      for (int x=0; x<width; x++)
+        *activation_element(a, c, x, y) = test_value(channel, x, y);
+  }
+}
+
+static void fill_weights(const filter_config_t* weights,
+                         const weight_blocks_t* blocks,
+                         const conv_shape_t* shape) {
+  for (int o=0; o<shape->out_channels; o++) {
+    for (int i=0; i<shape->in_channels; i++) {
+      filter_config_t filter = weight_slice(weights, blocks, i, i+1, o, o+1);
+      for (int y=0; y<shape->filter_height; y++)
+        for (int x=0; x<shape->filter_width; x++)
+          filter.data.address[(x * filter.row_stride + y * filter.column_stride) / sizeof(data_t)] =
+              test_value(o, i, y * shape->filter_width + x);
+    }
+  }
+}
+
+static unsigned int checksum_activations(const activation_config_t* a,
+                                         const int* channels, int num_channels,
+                                         int width, int height) {
+  unsigned int hash = 0;
+
+  for (int c=0; c<num_channels; c++) {
+    hash = hash * 31 + ((channels == NULL) ? c : channels[c]);
+    for (int y=0; y<height; y++)
+      for (int x=0; x<width; x++)
+        hash = hash * 31 + *activation_element(a, c, x, y);
+  }
+
+  return hash;
+}
+
+void fill_dense_buffers(void* data, const conv_shape_t* shape) {
+  dense_buffers_t* d = (dense_buffers_t*)data;
+
+  fill_activations(&d->input, NULL, shape->in_channels, shape->image_width,
+                   shape->image_height);
+  fill_weights(&d->weights, NULL, shape);
+
+  loki_channel_flush_data(1, d->input.data.address, shape->in_channels *
+                          shape->image_width * shape->image_height * sizeof(data_t));
+  loki_channel_flush_data(1, d->weights.data.address, shape->in_channels *
+                          shape->out_channels * shape->filter_width *
+                          shape->filter_height * sizeof(data_t));
+}
+
+void fill_sparse_buffers(void* data, const conv_shape_t* shape) {
+  sparse_buffers_t* d = (sparse_buffers_t*)data;
+
+  fill_activations(&d->input.dense, d->input.channels, d->input.num_channels,
+                   shape->image_width, shape->image_height);
+  fill_weights(&d->weights, &d->weight_blocks, shape);
+
+  // Blocked layouts are padded to whole blocks.
+  loki_channel_flush_data(1, d->input.dense.data.address, d->input.num_channels *
+                          shape->image_width * shape->image_height * sizeof(data_t));
+  int out_blocks = 1;
+  int block_stride = shape->in_channels * shape->out_channels *
+                     shape->filter_width * shape->filter_height * sizeof(data_t);
+  if (d->weight_blocks.block_size > 0) {
+    out_blocks = (shape->out_channels + d->weight_blocks.block_size - 1) /
+                 d->weight_blocks.block_size;
+    block_stride = d->weight_blocks.out_block_stride;
+  }
+  loki_channel_flush_data(1, d->weights.data.address, out_blocks * block_stride);
+}
+
+unsigned int checksum_dense_buffers(void* data, const conv_shape_t* shape) {
+  dense_buffers_t* d = (dense_buffers_t*)data;
+  int out_size = shape->image_width - shape->filter_width + 1;
+  return checksum_activations(&d->output, NULL, shape->out_channels,
+                              out_size, out_size);
+}
+
+unsigned int checksum_sparse_buffers(void* data, const conv_shape_t* shape) {
+  sparse_buffers_t* d = (sparse_buffers_t*)data;
+  int out_size = shape->image_width - shape->filter_width + 1;
+  return checksum_activations(&d->output.dense, d->output.channels,
+                              d->output.num_channels, out_size, out_size);
+}
+
+// Output pixel (x, y) of logical output channel `out`, computed directly from
+// the known values. Only the given input channels are non-zero (all of them if
+// `in_channels` is NULL).
+static data_t reference_output(const conv_shape_t* shape, const int* in_channels,
+                               int num_in_channels, int out, int x, int y) {
+  data_t sum = 0;
+
+  for (int c=0; c<num_in_channels; c++) {
+    int in = (in_channels == NULL) ? c : in_channels[c];
+    for (int fy=0; fy<shape->filter_height; fy++)
+      for (int fx=0; fx<shape->filter_width; fx++)
+        sum += test_value(in, x + fx, y + fy) *
+               test_value(out, in, fy * shape->filter_width + fx);
+  }
+
+  return sum;
+}
+
+// Checksum of a naive convolution, hashed in the same order as
+// checksum_activations.
+static unsigned int reference_checksum(const conv_shape_t* shape,
+                                       const int* in_channels, int num_in_channels,
+                                       const int* out_channels, int num_out_channels) {
+  int out_size = shape->image_width - shape->filter_width + 1;
+  unsigned int hash = 0;
+
+  for (int c=0; c<num_out_channels; c++) {
+    int out = (out_channels == NULL) ? c : out_channels[c];
+    hash = hash * 31 + out;
+    for (int y=0; y<out_size; y++)
+      for (int x=0; x<out_size; x++)
+        hash = hash * 31 + reference_output(shape, in_channels, num_in_channels,
+                                            out, x, y);
+  }
+
+  return hash;
+}
+
+unsigned int reference_checksum_dense_buffers(void* data, const conv_shape_t* shape) {
+  return reference_checksum(shape, NULL, shape->in_channels, NULL,
+                            shape->out_channels);
+}
+
+// Gating chose the output channels, so only their list is taken from memory.
+unsigned int reference_checksum_sparse_buffers(void* data, const conv_shape_t* shape) {
+  sparse_buffers_t* d = (sparse_buffers_t*)data;
+  return reference_checksum(shape, d->input.channels, d->input.num_channels,
+                            d->output.channels, d->output.num_channels);
+}
@@ -0,0 +1,190 @@
+// Communication patterns involving all tiles.
+//
+// Each collective operation has its own input channel, so messages belonging
+// to different operations can't be confused. Messages from a single tile
+// arrive in order, but messages from different tiles may not, so each message
+// is tagged with the round it belongs to.
+
+#include <loki/channels.h>
+#include <loki/channel_io.h>
+#include <loki/channel_map_table.h>
+#include <loki/ids.h>
+#include "defs.h"
+
+#define PREFIX_SUM_CHANNEL 6
+#define ALL_GATHER_CHANNEL 7
+
+// Reductions happen after tiles have synchronised following a prefix sum, and
+// before the next one, so they can share its channel.
+#define REDUCE_CHANNEL PREFIX_SUM_CHANNEL
+
+// Channel map table entry used to send collective messages.
+#define COLLECTIVE_OUTPUT 6
+
+// Each message is a single word: the round number in the top byte, and the
+// value in the rest.
+#define ROUND_SHIFT 24
+#define VALUE_MASK ((1 << ROUND_SHIFT) - 1)
+
+static void send_tagged(int tile, int channel, int round, int value) {
+  assert(value >= 0 && value <= VALUE_MASK);
+  channel_t address = loki_core_address(int2tile(tile), COMPONENT_CORE_0,
+                                        channel, DEFAULT_CREDIT_COUNT);
+  set_channel_map(COLLECTIVE_OUTPUT, address);
+  loki_send(COLLECTIVE_OUTPUT, (round << ROUND_SHIFT) | value);
+}
+
+// Wait for the message for a particular round. Messages for later rounds
+// which arrive first are stored in `early`, and `received` records which
+// rounds have arrived.
+static int receive_tagged(int channel, int round, int* early,
+                          unsigned int* received) {
+  while (!(*received & (1u << round))) {
+    int message = loki_receive(channel);
+    int message_round = (unsigned int)message >> ROUND_SHIFT;
+    early[message_round] = message & VALUE_MASK;
+    *received |= 1u << message_round;
+  }
+
+  return early[round];
+}
+
+// Recursive doubling: in round r, tiles whose numbers differ only in bit r
+// exchange the totals of the 2^r-tile blocks they represent. The lower tile's
+// block precedes the upper tile's, so the upper tile adds it to its prefix.
+//
+// With a tile count which is not a power of two, some partners don't exist.
+// Missing tiles always have higher numbers than everything in the block, so
+// prefixes are unaffected, but a lower tile with a missing partner still needs
+// the upper block's total. The upper tiles which do exist share these tiles
+// between them, and send each one their total as well.
+int exclusive_prefix_sum(int value, int num_tiles, int* total) {
+  int this_tile = tile2int(get_tile_id());
+  int prefix = 0;
+  int block_total = value;
+
+  int early[32];
+  unsigned int received = 0;
+
+  for (int round=0; (1 << round) < num_tiles; round++) {
+    int half = 1 << round;
+    int partner = this_tile ^ half;
+    int upper_start = (this_tile & ~(2 * half - 1)) + half;
+    int upper_size = num_tiles - upper_start;
+
+    // No tiles in the upper block: nothing to exchange.
+    if (upper_size <= 0)
+      continue;
+
+    if (partner < num_tiles)
+      send_tagged(partner, PREFIX_SUM_CHANNEL, round, block_total);
+
+    if (this_tile >= upper_start)
+      for (int k=upper_size+(this_tile-upper_start); k<half; k+=upper_size)
+        send_tagged(upper_start - half + k, PREFIX_SUM_CHANNEL, round, block_total);
+
+    int partner_total = receive_tagged(PREFIX_SUM_CHANNEL, round, early, &received);
+
+    if (partner < this_tile)
+      prefix += partner_total;
+    block_total += partner_total;
+  }
+
+  if (total != NULL)
+    *total = block_total;
+
+  return prefix;
+}
+
+// Tile t first receives the broadcast at step ceil(log2(t+1)), so its first
+// child is the smallest power of two above it.
+int tree_first_step(int tile) {
+  int step = 1;
+  while (step <= tile)
+    step *= 2;
+  return step;
+}
+
+// Binomial tree: in round r, a tile whose rank in the group has bit r set, and
+// no lower bits, sends its sum to the tile 2^r below it, and has finished.
+// Before that, it receives the sum of each tile 2^r above it for the earlier
+// rounds. Messages only say which tile is ready; the data is transferred
+// through memory. Integer addition is associative, so the result doesn't
+// depend on the shape of the tree.
+void reduce_partial_sums(const reduction_t* reduction, data_t* buffer,
+                         int offset, int count) {
+  int rank = tile2int(get_tile_id()) - reduction->first_tile;
+
+  int early[32];
+  unsigned int received = 0;
+
+  for (int round=0; (1 << round) < reduction->size; round++) {
+    if (rank & (1 << round)) {
+      loki_channel_flush_data(1, buffer + offset, count * sizeof(data_t));
+      send_tagged(reduction->first_tile + rank - (1 << round), REDUCE_CHANNEL,
+                  round, rank);
+      return;
+    }
+
+    if (rank + (1 << round) >= reduction->size)
+      continue;
+
+    int child = receive_tagged(REDUCE_CHANNEL, round, early, &received);
+    int child_tile = reduction->first_tile + child;
+    loki_channel_invalidate_data(1, &reduction->partials[child_tile],
+                                 sizeof(data_t*));
+    const data_t* partial = reduction->partials[child_tile] + offset;
+    loki_channel_invalidate_data(1, partial, count * sizeof(data_t));
+
+    for (int i=0; i<count; i++)
+      buffer[offset + i] += partial[i];
+  }
+
+  // This is the first tile: the result is complete.
+  loki_channel_flush_data(1, buffer + offset, count * sizeof(data_t));
+}
+
+// Each announcement is a single word: the first element in the top half, and
+// the number of elements in the bottom half. Data is transferred through
+// memory.
+void all_gather_init(all_gather_t* state, void* array, int element_size,
+                     int expected) {
+  state->array = array;
+  state->element_size = element_size;
+  state->remaining = expected;
+}
+
+void all_gather_publish(all_gather_t* state, int first, int count,
+                        int num_tiles) {
+  assert(first < (1 << 16) && count < (1 << 16));
+  loki_channel_flush_data(1, state->array + first * state->element_size,
+                          count * state->element_size);
+
+  int this_tile = tile2int(get_tile_id());
+  for (int tile=0; tile<num_tiles; tile++) {
+    if (tile == this_tile)
+      continue;
+
+    channel_t address = loki_core_address(int2tile(tile), COMPONENT_CORE_0,
+                                          ALL_GATHER_CHANNEL, DEFAULT_CREDIT_COUNT);
+    set_channel_map(COLLECTIVE_OUTPUT, address);
+    loki_send(COLLECTIVE_OUTPUT, (first << 16) | count);
+  }
+}
+
+bool all_gather_receive(all_gather_t* state, int* first, int* count, bool wait) {
+  if (state->remaining == 0)
+    return false;
+  if (!wait && !loki_test_channel(ALL_GATHER_CHANNEL))
+    return false;
+
+  int message = loki_receive(ALL_GATHER_CHANNEL);
+  *first = (unsigned int)message >> 16;
+  *count = message & 0xffff;
+  state->remaining -= *count;
+
+  loki_channel_invalidate_data(1, state->array + *first * state->element_size,
+                               *count * state->element_size);
+
+  return true;
+}
@@ -1,17 +1,23 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <loki/alloc.h>
+#include <loki/channels.h>
 #include <loki/channel_map_table.h>
 #include <loki/control_registers.h>
+#include <loki/spawn.h>
 #include <nn/layers.h>
 #include "defs.h"
 
 #define LOAD_BALANCE
 
-// Random data used to select output channels.
+// Random data used to select input channels, and output channels when
+// GATING_RANDOM is used.
 // For any section of the array, discarding values below X will give a result
 // which is roughly X% sparse.
 // Generated using:
 // python -c "import random; print([random.randint(0,99) for _ in range(5000)])"
-int random[5000] = {
+int random_numbers[5000] = {
 #include "data.txt"
 };
 
@@ -38,7 +44,7 @@ loop_nest_t LOOP_NEST_FEW_CHANNELS = {
 };
 
 void test_none(const conv_shape_t* shape, void* data,
-               int in_sparsity, int out_sparsity, int num_tiles) {
+               const test_options_t* options) {
   dense_buffers_t* buffers = (dense_buffers_t*)data;
 
   // Step 1: downsample inputs. Unused.
@@ -48,6 +54,7 @@ void test_none(const conv_shape_t* shape, void* data,
   // Step 5: sparse convolution.
   // 'none' mode: convolution isn't sparse at all.
   int this_tile = tile2int(get_tile_id());
+  int num_tiles = options->num_tiles;
   conv_task_t tile_task = get_tile_conv_task(shape, this_tile, num_tiles);
 
   conv_shape_t slice = get_conv_slice(shape, &tile_task);
@@ -55,20 +62,135 @@ void test_none(const conv_shape_t* shape, void* data,
   filter_config_t weights_slice = get_weights_conv_slice(&buffers->weights, &tile_task);
   activation_config_t output_slice = get_output_conv_slice(&buffers->output, &tile_task);
 
+  unsigned long start = get_cycle_count();
   lat_conv2d(&input_slice, &weights_slice, &output_slice, &slice,
              &LOOP_NEST_MANY_CHANNELS);
+  profile_phase(PHASE_CONV, start);
 
 }
 
-void test_simple(const conv_shape_t* shape, void* data,
-                 int in_sparsity, int out_sparsity, int num_tiles) {
-  sparse_buffers_t* buffers = (sparse_buffers_t*)data;
+// Number of pieces each tile's downsampling is split into, so that results can
+// be shared with other tiles while the rest are computed.
+#define DOWNSAMPLE_CHUNKS 4
+
+// Copy downsampled channels [first, first+count) of the compressed tensor into
+// their dense positions in the auxiliary input.
+static void scatter_downsampled(const sparse_activations_t* downsampled,
+                                data_t* aux_input, int first, int count) {
+  for (int i=first; i<first+count; i++)
+    aux_input[downsampled->channels[i]] = downsampled->dense.data.address[i];
+}
+
+// Smallest band of output rows worth computing separately. Each band costs an
+// extra convolution for every input channel, so small images aren't split.
+#define MIN_BAND_ROWS 16
+
+// Choose how to share `out_channels` output channels, computed from
+// `in_channels` input channels, between tiles. All tiles make the same choice.
+static partition_t choose_partition(partition_t requested, int in_channels,
+                                    int out_channels, int rows, int num_tiles) {
+  if (requested != PARTITION_AUTO)
+    return requested;
+
+  // Every tile can have its own output channels, or there is nothing to do.
+  if (out_channels >= num_tiles || out_channels == 0 || in_channels < 2)
+    return PARTITION_OUTPUT;
+
+  // Bands of rows are independent, so are cheaper than partial sums which
+  // need adding together, as long as they are big enough.
+  if (rows / (num_tiles / out_channels) >= MIN_BAND_ROWS)
+    return PARTITION_OUTPUT;
+
+  return (out_channels == 1) ? PARTITION_INPUT : PARTITION_2D;
+}
+
+// Share the work between `groups` groups of tiles, which each compute some of
+// the output channels. The tiles in a group split the input channels, and
+// their partial sums are reduced to the group's first tile. `task` covers
+// everything. Any tiles left over are given nothing.
+static conv_task_t get_channel_grid_task(const conv_task_t* task, int groups,
+                                         int this_tile, int num_tiles,
+                                         reduction_t* reduction) {
+  int in_channels = task->last_in_channel - task->first_in_channel;
+  int out_channels = task->last_out_channel - task->first_out_channel;
+  int tiles_per_group = num_tiles / groups;
+  int group = this_tile / tiles_per_group;
+  int rank = this_tile % tiles_per_group;
+
+  // Every tile in a group needs at least one input channel.
+  int group_size = (tiles_per_group < in_channels) ? tiles_per_group : in_channels;
+
+  conv_task_t grid_task = *task;
+
+  if (group >= groups || rank >= group_size) {
+    grid_task.last_out_channel = grid_task.first_out_channel;
+    return grid_task;
+  }
+
+  grid_task.first_out_channel = task->first_out_channel + out_channels * group / groups;
+  grid_task.last_out_channel = task->first_out_channel + out_channels * (group + 1) / groups;
+  grid_task.first_in_channel = task->first_in_channel + in_channels * rank / group_size;
+  grid_task.last_in_channel = task->first_in_channel + in_channels * (rank + 1) / group_size;
+  grid_task.partial_sums = (group_size > 1);
 
+  reduction->first_tile = group * tiles_per_group;
+  reduction->size = group_size;
+
+  return grid_task;
+}
+
+// Give this tile a zeroed buffer of partial sums for output channels
+// [first, last). Buffers are kept for later runs.
+static void init_partial_sums(const conv_shape_t* shape,
+                              sparse_buffers_t* buffers, int first, int last) {
+  int this_tile = tile2int(get_tile_id());
+  int channel_size = buffers->output.dense.channel_stride / sizeof(data_t);
+
+  if (buffers->partial_sums[this_tile] == NULL) {
+    buffers->partial_sums[this_tile] =
+        loki_malloc(shape->out_channels * channel_size * sizeof(data_t));
+    assert(buffers->partial_sums[this_tile] != NULL);
+    loki_channel_flush_data(1, &buffers->partial_sums[this_tile], sizeof(data_t*));
+  }
+
+  memset(buffers->partial_sums[this_tile] + first * channel_size, 0,
+         (last - first) * channel_size * sizeof(data_t));
+}
+
+// Share `channels` output channels between tiles by giving each channel's rows
+// to a group of tiles. `task` covers all rows and input channels. Any tiles
+// left over are given nothing.
+static conv_task_t get_row_band_task(const conv_task_t* task, int channels,
+                                     int this_tile, int num_tiles) {
+  int tiles_per_channel = num_tiles / channels;
+  int channel = this_tile / tiles_per_channel;
+  int band = this_tile % tiles_per_channel;
+  int rows = task->last_row - task->first_row;
+
+  conv_task_t band_task = *task;
+  band_task.first_out_channel = (channel < channels) ? channel : channels;
+  band_task.last_out_channel = (channel < channels) ? channel + 1 : channels;
+  band_task.first_row = task->first_row + rows * band / tiles_per_channel;
+  band_task.last_row = task->first_row + rows * (band + 1) / tiles_per_channel;
+  return band_task;
+}
+
+// Steps 1-4, common to all sparse modes. Determine which output channels to
+// compute, and return this tile's initial share of the sparse convolution.
+// `reduction` describes the tiles whose partial sums must be combined with
+// this tile's.
+static conv_task_t compute_gating(const conv_shape_t* shape,
+                                  sparse_buffers_t* buffers,
+                                  const test_options_t* options,
+                                  reduction_t* reduction) {
   // For most computations, each tile uses all inputs to compute a fraction of
   // the outputs. For downsampling, only a fraction of inputs are used.
   int this_tile = tile2int(get_tile_id());
+  int num_tiles = options->num_tiles;
   conv_task_t conv_task = get_tile_conv_task(shape, this_tile, num_tiles);
 
+  unsigned long phase_start = get_cycle_count();
+
   // Step 1: downsample inputs.
   // This pool_shape_t is for the whole layer. Later it is broken down for this
   // tile.
@@ -81,28 +203,65 @@ void test_simple(const conv_shape_t* shape, void* data,
   pool_params.window_height = shape->image_height;
   pool_params.stride = 1; // irrelevant
 
-  pool_task_t pool_task = get_tile_pool_task(&pool_params, this_tile, num_tiles);
+  // Only stored input channels need downsampling, so share those evenly.
+  pool_task_t pool_task = get_sparse_pool_task(&buffers->input, &pool_params,
+                                               this_tile, num_tiles);
   pool_shape_t pool_slice = get_pool_slice(&pool_params, &pool_task);
   sparse_activations_t pool_in_slice = get_sparse_input_pool_slice(&buffers->input, &pool_task);
   sparse_activations_t pool_out_slice = get_sparse_output_pool_slice(&buffers->input_downsampled, &pool_task);
-  // Adjust number of channels because this computation is sparse.
-  pool_slice.channels = pool_in_slice.num_channels;
 
-  lat_max_pool_2d(&pool_in_slice.dense, &pool_out_slice.dense,
-                  &pool_slice);
+  // The auxiliary layer reads all input channels, so each tile needs its own
+  // dense copy of everything that was downsampled. Channels which weren't
+  // computed are zero.
+  data_t* aux_input = loki_malloc(shape->in_channels * sizeof(data_t));
+  assert(aux_input != NULL);
+  for (int i=0; i<shape->in_channels; i++)
+    aux_input[i] = 0;
+
+  // Downsample in chunks. After each chunk, tell the other tiles that it is
+  // ready, and collect any chunks which they have finished.
+  int first_local = pool_in_slice.channels - buffers->input.channels;
+  all_gather_t gather;
+  all_gather_init(&gather, buffers->input_downsampled.dense.data.address,
+                  sizeof(data_t),
+                  buffers->input.num_channels - pool_in_slice.num_channels);
+
+  for (int chunk=0; chunk<DOWNSAMPLE_CHUNKS; chunk++) {
+    int first = pool_in_slice.num_channels * chunk / DOWNSAMPLE_CHUNKS;
+    int last = pool_in_slice.num_channels * (chunk + 1) / DOWNSAMPLE_CHUNKS;
 
-  // TODO Share downsampled data with other tiles - needed for aux computation.
+    if (last > first) {
+      activation_config_t chunk_in = activation_slice(&pool_in_slice.dense, first, last);
+      activation_config_t chunk_out = activation_slice(&pool_out_slice.dense, first, last);
+      // Adjust number of channels because this computation is sparse.
+      pool_slice.channels = last - first;
+
+      lat_max_pool_2d(&chunk_in, &chunk_out, &pool_slice);
+
+      all_gather_publish(&gather, first_local + first, last - first, num_tiles);
+      scatter_downsampled(&buffers->input_downsampled, aux_input,
+                          first_local + first, last - first);
+    }
+
+    int first_remote, count_remote;
+    while (all_gather_receive(&gather, &first_remote, &count_remote, false))
+      scatter_downsampled(&buffers->input_downsampled, aux_input,
+                          first_remote, count_remote);
+  }
+
+  int first_remote, count_remote;
+  while (all_gather_receive(&gather, &first_remote, &count_remote, true))
+    scatter_downsampled(&buffers->input_downsampled, aux_input,
+                        first_remote, count_remote);
+
+  phase_start = profile_phase(PHASE_DOWNSAMPLE, phase_start);
 
   // Step 2: auxiliary convolution. Since we downsampled the inputs to 1x1, this
   // is equivalent to a fully-connected/linear layer.
-  // First scatter the sparse data into the dense auxiliary input.
-  for (int i=0; i<pool_out_slice.num_channels; i++) {
-    int channel = pool_out_slice.channels[i];
-    buffers->auxiliary->input.data.address[channel] =
-        pool_out_slice.dense.data.address[i];
-  }
+  activation_config_t aux_in = buffers->auxiliary->input;
+  aux_in.data.address = aux_input;
 
-  activation_config_t aux_in_slice = get_input_conv_slice(&buffers->auxiliary->input, &conv_task);
+  activation_config_t aux_in_slice = get_input_conv_slice(&aux_in, &conv_task);
   filter_config_t aux_weights_slice = get_weights_conv_slice(&buffers->auxiliary->weights, &conv_task);
   activation_config_t aux_out_slice = get_output_conv_slice(&buffers->auxiliary->output, &conv_task);
 
@@ -111,18 +270,39 @@ void test_simple(const conv_shape_t* shape, void* data,
              conv_slice.batch_size, conv_slice.in_channels, conv_slice.out_channels,
              &LOOP_NEST_MANY_CHANNELS);
 
+  loki_free(aux_input);
+
+  // Top-k gating ranks every output channel, so needs the other tiles'
+  // auxiliary outputs too.
+  if (options->gating == GATING_TOP_K && num_tiles > 1) {
+    loki_channel_flush_data(1, aux_out_slice.data.address,
+                            conv_slice.out_channels * sizeof(data_t));
+    loki_sync_tiles(num_tiles);
+    loki_channel_invalidate_data(1, buffers->auxiliary->output.data.address,
+                                 shape->out_channels * sizeof(data_t));
+  }
+
+  phase_start = profile_phase(PHASE_AUXILIARY, phase_start);
+
   // Steps 3+4: discard any features below a threshold.
-  // In order to have more control over the sparsity achieved, a predetermined
-  // random sequence is used for this, instead of the output of step 2.
-  int out_channels_count = 0;
-  int first_out_channel = this_tile * conv_slice.out_channels;
-  for (int i=first_out_channel; i<first_out_channel+conv_slice.out_channels; i++)
-    if (random[5000 - i] > out_sparsity)
-      buffers->output.channels[first_out_channel + out_channels_count++] = i;
-  buffers->output.num_channels = out_channels_count; // NEEDS SYNC
-
-  // TODO: share with other tiles how many channels will be computed. Needed to
-  // know where in the total output our slice will go.
+  // By default, a predetermined random sequence is used for this instead of the
+  // output of step 2, to give more control over the sparsity achieved.
+  int* out_channels_used = loki_malloc(conv_slice.out_channels * sizeof(int));
+  assert(out_channels_used != NULL);
+  int out_channels_count =
+      select_output_channels(shape, buffers, &conv_task, options, out_channels_used);
+
+  // Share with other tiles how many channels will be computed, to find where
+  // in the total output our slice will go.
+  int total_out;
+  int first_sparse_out = exclusive_prefix_sum(out_channels_count, num_tiles,
+                                              &total_out);
+  for (int i=0; i<out_channels_count; i++)
+    buffers->output.channels[first_sparse_out + i] = out_channels_used[i];
+  loki_free(out_channels_used);
+
+  if (this_tile == num_tiles - 1)
+    buffers->output.num_channels = first_sparse_out + out_channels_count;
 
   // This tile's initial work allocation for the sparse convolution.
   // This task may be modified as computation progresses, as work is
@@ -130,8 +310,101 @@ void test_simple(const conv_shape_t* shape, void* data,
   conv_task_t task;
   task.first_in_channel = 0;
   task.last_in_channel = buffers->input.num_channels;
-  task.first_out_channel = out_channels_count * this_tile; // FAKE
+  task.first_out_channel = first_sparse_out;
   task.last_out_channel = task.first_out_channel + out_channels_count;
+  task.first_row = 0;
+  task.last_row = conv_output_rows(shape);
+  task.partial_sums = false;
+
+  reduction->first_tile = this_tile;
+  reduction->size = 1;
+  reduction->partials = buffers->partial_sums;
+
+  // Gating leaves tiles with different numbers of output channels, so share
+  // out the chosen channels again. Every task uses all input channels and
+  // rows, so equal numbers of output channels are equal amounts of work. With
+  // fewer output channels than tiles, some tiles would have nothing to do
+  // until they could steal work. Share each channel between a group of tiles
+  // instead, either by rows, or by input channels. Tiles now need to know
+  // which channels other tiles chose.
+  partition_t partition = choose_partition(options->partition,
+                                           buffers->input.num_channels,
+                                           total_out, task.last_row, num_tiles);
+
+  if (total_out > 0 && num_tiles > 1) {
+    // Every tile has contributed to the prefix sum, so has finished receiving
+    // downsampled channels, and the all-gather channel is free to reuse.
+    all_gather_init(&gather, buffers->output.channels, sizeof(int),
+                    total_out - out_channels_count);
+    if (out_channels_count > 0)
+      all_gather_publish(&gather, first_sparse_out, out_channels_count, num_tiles);
+    while (all_gather_receive(&gather, &first_remote, &count_remote, true))
+      ;
+
+    conv_task_t all = task;
+    all.first_out_channel = 0;
+    all.last_out_channel = total_out;
+
+    switch (partition) {
+      case PARTITION_OUTPUT:
+      default:
+        if (total_out >= num_tiles)
+          task = get_channel_grid_task(&all, num_tiles, this_tile, num_tiles,
+                                       reduction);
+        else
+          task = get_row_band_task(&all, total_out, this_tile, num_tiles);
+        break;
+      case PARTITION_INPUT:
+        task = get_channel_grid_task(&all, 1, this_tile, num_tiles, reduction);
+        break;
+      case PARTITION_2D: {
+        int groups = (total_out < num_tiles / 2) ? total_out : num_tiles / 2;
+        if (groups < 1)
+          groups = 1;
+        task = get_channel_grid_task(&all, groups, this_tile, num_tiles, reduction);
+        break;
+      }
+    }
+
+    if (reduction->size > 1 && this_tile != reduction->first_tile)
+      init_partial_sums(shape, buffers, task.first_out_channel,
+                        task.last_out_channel);
+  }
+
+  profile_phase(PHASE_GATING, phase_start);
+
+  return task;
+}
+
+// Step 5 for each sparse mode. `task` is this tile's initial share of the
+// work, from compute_gating.
+
+// Return the end of the band of output rows starting at `row`, for a group of
+// output channels ending at `last_out`. Until a tile reaches the last output
+// channels of its task, spare channels can be given away, so all rows are
+// computed at once. The last channels are computed in bands, so that rows
+// which haven't been started can be given away instead.
+static int band_end(const conv_task_t* task, int row, int last_out,
+                    int num_tiles) {
+  if (last_out < task->last_out_channel || num_tiles == 1)
+    return task->last_row;
+
+  int rows = (task->last_row - task->first_row + num_tiles - 1) / num_tiles;
+  if (rows < MIN_BAND_ROWS)
+    rows = MIN_BAND_ROWS;
+
+  // Don't leave a band smaller than the minimum at the end.
+  if (task->last_row - (row + rows) < MIN_BAND_ROWS)
+    return task->last_row;
+
+  return row + rows;
+}
+
+static void sparse_conv_simple(const conv_shape_t* shape,
+                               sparse_buffers_t* buffers,
+                               const test_options_t* options,
+                               conv_task_t task) {
+  int num_tiles = options->num_tiles;
 
   // Step 5: sparse convolution.
   // 'simple' mode: repeatedly apply one filter to one input channel.
@@ -147,37 +420,69 @@ void test_simple(const conv_shape_t* shape, void* data,
   unit.stride = 1;
   unit.dilation = 1;
 
+  // Convolutions are queued so that the next one can be prepared, and load
+  // balancing requests handled, while the accelerator is busy.
+  conv_queue_t accelerator;
+  init_conv_queue(&accelerator, options->async_conv);
+
 #ifdef LOAD_BALANCE
-  // TODO: Make load balancing optional.
   lb_state_t load_balance;
-  init_lb_state(&load_balance, num_tiles);
+  init_lb_state(&load_balance, shape, buffers, options, STRATEGY_SIMPLE, &task);
 
   while (!lb_finished(&load_balance)) {
 #endif
 
     // i and o iterate through only the channels which have been computed.
     for (int o=task.first_out_channel; o<task.last_out_channel; o++) {
-      for (int i=task.first_in_channel; i<task.last_in_channel; i++) {
-        // in_c and out_c iterate through all channels (including uncomputed).
-        int out_c = buffers->output.channels[o];
-        int in_c = buffers->input.channels[i];
+      for (int row=task.first_row, row_end; row<task.last_row; row=row_end) {
+        row_end = band_end(&task, row, o+1, num_tiles);
+        conv_task_t current = {
+          .first_in_channel = task.first_in_channel,
+          .last_in_channel = task.last_in_channel,
+          .first_out_channel = o, .last_out_channel = o+1,
+          .first_row = row, .last_row = row_end,
+          .partial_sums = task.partial_sums
+        };
+#ifdef LOAD_BALANCE
+        // Core 1 may have given this work away.
+        if (!claim_work(&load_balance, &task, &current))
+          break;
+        row_end = current.last_row;
+#endif
+
+        activation_config_t band_input = input_row_slice(&buffers->input.dense, &unit, row);
+        activation_config_t band_output = output_row_slice(&buffers->output.dense, row);
 
-        activation_config_t conv_i = activation_slice(&buffers->input.dense, i, i+1);
-        filter_config_t conv_w = weight_slice(&buffers->weights, in_c, in_c+1, out_c, out_c+1);
-        activation_config_t conv_o = activation_slice(&buffers->output.dense, o, o+1);
+        for (int i=task.first_in_channel; i<task.last_in_channel; i++) {
+          // in_c and out_c iterate through all channels (including uncomputed).
+          int out_c = buffers->output.channels[o];
+          int in_c = buffers->input.channels[i];
+          current.first_in_channel = i;
 
-        lat_conv2d(&conv_i, &conv_w, &conv_o, &unit, &LOOP_NEST_FEW_CHANNELS);
+          conv_command_t conv;
+          conv.input = activation_slice(&band_input, i, i+1);
+          conv.weights = weight_slice(&buffers->weights, &buffers->weight_blocks,
+                                      in_c, in_c+1, out_c, out_c+1);
+          conv.output = activation_slice(&band_output, o, o+1);
+          conv.shape = get_row_band_shape(&unit, row, row_end);
+          conv.loop_nest = tuned_loop_nest(&conv.shape, &LOOP_NEST_FEW_CHANNELS);
 
+          // Prepare the next convolution while earlier ones run. These rows of
+          // output channel o have work queued, so must be kept.
+          do {
 #ifdef LOAD_BALANCE
-        // Give up any spare work, if requested.
-        // TODO: Do this while waiting on the accelerator.
-        check_load_balance_requests(&task, &load_balance, i+1, o);
+            // Give up any spare work, if requested.
+            check_load_balance_requests(&task, &load_balance, &current);
 #endif
+          } while (conv_queue_full(&accelerator));
+
+          conv_submit(&accelerator, &conv);
+        }
       }
     }
 
 #ifdef LOAD_BALANCE
-    // Request new work from a neighbouring tile. This will update `task`.
+    // Request new work from another tile. This will update `task`.
     make_load_balance_request(&task, &load_balance, num_tiles);
 
   }
@@ -186,82 +491,17 @@ void test_simple(const conv_shape_t* shape, void* data,
   lb_sync(&load_balance);
 #endif
 
-}
-
-// TODO: reduce code duplication.
-// This is identical to test_simple except the for loops in step 5.
-void test_adaptive(const conv_shape_t* shape, void* data,
-                   int in_sparsity, int out_sparsity, int num_tiles) {
-  sparse_buffers_t* buffers = (sparse_buffers_t*)data;
-
-  // For most computations, each tile uses all inputs to compute a fraction of
-  // the outputs. For downsampling, only a fraction of inputs are used.
-  int this_tile = tile2int(get_tile_id());
-  conv_task_t conv_task = get_tile_conv_task(shape, this_tile, num_tiles);
-
-  // Step 1: downsample inputs.
-  // This pool_shape_t is for the whole layer. Later it is broken down for this
-  // tile.
-  pool_shape_t pool_params;
-  pool_params.batch_size = shape->batch_size;
-  pool_params.channels = shape->in_channels;
-  pool_params.input_width = shape->image_width;
-  pool_params.input_height = shape->image_height;
-  pool_params.window_width = shape->image_width;
-  pool_params.window_height = shape->image_height;
-  pool_params.stride = 1; // irrelevant
-
-  pool_task_t pool_task = get_tile_pool_task(&pool_params, this_tile, num_tiles);
-  pool_shape_t pool_slice = get_pool_slice(&pool_params, &pool_task);
-  sparse_activations_t pool_in_slice = get_sparse_input_pool_slice(&buffers->input, &pool_task);
-  sparse_activations_t pool_out_slice = get_sparse_output_pool_slice(&buffers->input_downsampled, &pool_task);
-  // Adjust number of channels because this computation is sparse.
-  pool_slice.channels = pool_in_slice.num_channels;
-
-  lat_max_pool_2d(&pool_in_slice.dense, &pool_out_slice.dense,
-                 &pool_slice);
-
-  // TODO Share downsampled data with other tiles - needed for aux computation.
-
-  // Step 2: auxiliary convolution. Since we downsampled the inputs to 1x1, this
-  // is equivalent to a fully-connected/linear layer.
-  // First scatter the sparse data into the dense auxiliary input.
-  for (int i=0; i<pool_out_slice.num_channels; i++) {
-    int channel = pool_out_slice.channels[i];
-    buffers->auxiliary->input.data.address[channel] =
-        pool_out_slice.dense.data.address[i];
-  }
-
-  activation_config_t aux_in_slice = get_input_conv_slice(&buffers->auxiliary->input, &conv_task);
-  filter_config_t aux_weights_slice = get_weights_conv_slice(&buffers->auxiliary->weights, &conv_task);
-  activation_config_t aux_out_slice = get_output_conv_slice(&buffers->auxiliary->output, &conv_task);
-
-  conv_shape_t conv_slice = get_conv_slice(shape, &conv_task);
-  lat_linear(&aux_in_slice, &aux_weights_slice, &aux_out_slice,
-             conv_slice.batch_size, conv_slice.in_channels, conv_slice.out_channels,
-             &LOOP_NEST_MANY_CHANNELS);
+  delete_conv_queue(&accelerator);
 
-  // Steps 3+4: discard any features below a threshold.
-  // In order to have more control over the sparsity achieved, a predetermined
-  // random sequence is used for this, instead of the output of step 2.
-  int out_channels_count = 0;
-  int first_out_channel = this_tile * conv_slice.out_channels;
-  for (int i=first_out_channel; i<first_out_channel+conv_slice.out_channels; i++)
-    if (random[5000 - i] > out_sparsity)
-      buffers->output.channels[first_out_channel + out_channels_count++] = i;
-  buffers->output.num_channels = out_channels_count; // NEEDS SYNC
-
-  // TODO: share with other tiles how many channels will be computed. Needed to
-  // know where in the total output our slice will go.
+}
 
-  // This tile's initial work allocation for the sparse convolution.
-  // This task may be modified as computation progresses, as work is
-  // redistributed among the parallel tiles.
-  conv_task_t task;
-  task.first_in_channel = 0;
-  task.last_in_channel = buffers->input.num_channels;
-  task.first_out_channel = out_channels_count * this_tile; // FAKE
-  task.last_out_channel = task.first_out_channel + out_channels_count;
+// Like sparse_conv_simple, but each convolution covers runs of consecutive
+// input and output channels.
+static void sparse_conv_adaptive(const conv_shape_t* shape,
+                                 sparse_buffers_t* buffers,
+                                 const test_options_t* options,
+                                 conv_task_t task) {
+  int num_tiles = options->num_tiles;
 
   // Step 5: sparse convolution.
   // 'adaptive' mode: look for sequences of consecutive channels available, and
@@ -276,58 +516,432 @@ void test_adaptive(const conv_shape_t* shape, void* data,
   unit.stride = 1;
   unit.dilation = 1;
 
+  // Convolutions are queued so that the next one can be prepared, and load
+  // balancing requests handled, while the accelerator is busy.
+  conv_queue_t accelerator;
+  init_conv_queue(&accelerator, options->async_conv);
+
 #ifdef LOAD_BALANCE
-  // TODO: Make load balancing optional.
   lb_state_t load_balance;
-  init_lb_state(&load_balance, num_tiles);
+  init_lb_state(&load_balance, shape, buffers, options, STRATEGY_ADAPTIVE, &task);
 
   while (!lb_finished(&load_balance)) {
 #endif
 
+    // Runs of consecutive output channels in this task. Input runs are shared
+    // by all tasks, so were found when the input was created.
+    channel_runs_t out_runs;
+    init_channel_runs(&out_runs, &buffers->output, task.first_out_channel,
+                      task.last_out_channel);
+    const channel_runs_t* in_runs = &buffers->input_runs;
+    int first_in_run = find_channel_run(in_runs, task.first_in_channel);
+
     // i and o iterate through only the channels which have been computed.
-    for (int o=task.first_out_channel; o<task.last_out_channel; /*update within loop*/) {
+    // Runs are broken up wherever they cross a weight block boundary. The end
+    // of the output run is checked every time, as it may be given away.
+    for (int r_out=0; r_out<out_runs.num_runs; r_out++) {
+      const channel_run_t* out_run = &out_runs.runs[r_out];
+
+      for (int o=out_run->first; o<out_run->first+out_run->length; o+=unit.out_channels) {
+        unit.out_channels = weight_block_run(&buffers->weight_blocks,
+                                             buffers->output.channels[o],
+                                             out_run->first + out_run->length - o);
+
+        for (int row=task.first_row, row_end; row<task.last_row; row=row_end) {
+          row_end = band_end(&task, row, o + unit.out_channels, num_tiles);
+          conv_task_t current = {
+            .first_in_channel = task.first_in_channel,
+            .last_in_channel = task.last_in_channel,
+            .first_out_channel = o, .last_out_channel = o + unit.out_channels,
+            .first_row = row, .last_row = row_end,
+            .partial_sums = task.partial_sums
+          };
+#ifdef LOAD_BALANCE
+          // Core 1 may have given some of this work away.
+          bool claimed = claim_work(&load_balance, &task, &current);
+          truncate_channel_runs(&out_runs, task.last_out_channel);
+          if (!claimed)
+            break;
+          unit.out_channels = current.last_out_channel - o;
+          row_end = current.last_row;
+#endif
+
+          activation_config_t band_input = input_row_slice(&buffers->input.dense, &unit, row);
+          activation_config_t band_output = output_row_slice(&buffers->output.dense, row);
 
-      // Count contiguous output channels.
-      unit.out_channels = 1;
-      while ((o + unit.out_channels < task.last_out_channel) &&
-             (buffers->output.channels[o + unit.out_channels] == buffers->output.channels[o] + unit.out_channels))
-        unit.out_channels++;
+          for (int r_in=first_in_run; r_in<in_runs->num_runs; r_in++) {
+            // Clip the run to the task.
+            int first_i = in_runs->runs[r_in].first;
+            int last_i = first_i + in_runs->runs[r_in].length;
+            if (first_i < task.first_in_channel)
+              first_i = task.first_in_channel;
+            if (last_i > task.last_in_channel)
+              last_i = task.last_in_channel;
+            if (first_i >= last_i)
+              break;
 
-      for (int i=task.first_in_channel; i<task.last_in_channel; /*update within loop*/) {
-        // Count contiguous input channels. Could precompute this instead of doing
-        // it every iteration?
-        unit.in_channels = 1;
-        while ((i + unit.in_channels < task.last_in_channel) &&
-               (buffers->input.channels[i + unit.in_channels] == buffers->input.channels[i] + unit.in_channels))
-          unit.in_channels++;
+            for (int i=first_i; i<last_i; i+=unit.in_channels) {
+              unit.in_channels = weight_block_run(&buffers->weight_blocks,
+                                                  buffers->input.channels[i],
+                                                  last_i - i);
 
-        // in_c and out_c iterate through all channels (including uncomputed).
-        int out_c = buffers->output.channels[o];
-        int in_c = buffers->input.channels[i];
+              // in_c and out_c iterate through all channels (including uncomputed).
+              int out_c = buffers->output.channels[o];
+              int in_c = buffers->input.channels[i];
+              current.first_in_channel = i;
 
-        activation_config_t conv_i = activation_slice(&buffers->input.dense, i, i+unit.in_channels);
-        filter_config_t conv_w = weight_slice(&buffers->weights, in_c, in_c+unit.in_channels, out_c, out_c+unit.out_channels);
-        activation_config_t conv_o = activation_slice(&buffers->output.dense, o, o+unit.out_channels);
+              conv_command_t conv;
+              conv.input = activation_slice(&band_input, i, i+unit.in_channels);
+              conv.weights = weight_slice(&buffers->weights, &buffers->weight_blocks,
+                                          in_c, in_c+unit.in_channels,
+                                          out_c, out_c+unit.out_channels);
+              conv.output = activation_slice(&band_output, o, o+unit.out_channels);
+              conv.shape = get_row_band_shape(&unit, row, row_end);
+              conv.loop_nest = tuned_loop_nest(&conv.shape, &LOOP_NEST_FEW_CHANNELS);
 
-        // printf("%lu x %lu mini-conv\n", shape.in_channels, shape.out_channels);
-        lat_conv2d(&conv_i, &conv_w, &conv_o, &unit, &LOOP_NEST_FEW_CHANNELS);
-        // Potential optimisation: set up the next convolution while waiting for
-        // this one to finish.
+              // Prepare the next convolution while earlier ones run. These
+              // output channels have work queued, so must be kept.
+              do {
+#ifdef LOAD_BALANCE
+                // Give up any spare work, if requested. Later output runs may
+                // no longer belong to this tile.
+                check_load_balance_requests(&task, &load_balance, &current);
+                truncate_channel_runs(&out_runs, task.last_out_channel);
+#endif
+              } while (conv_queue_full(&accelerator));
+
+              conv_submit(&accelerator, &conv);
+            }
+          }
+        }
+      }
+    }
+
+    delete_channel_runs(&out_runs);
+
+#ifdef LOAD_BALANCE
+    // Request new work from another tile. This will update `task`.
+    make_load_balance_request(&task, &load_balance, num_tiles);
+
+  }
+
+  // Ensure we respond to any outstanding requests.
+  lb_sync(&load_balance);
+#endif
+
+  delete_conv_queue(&accelerator);
+
+}
+
+// Copy the filters between the given compressed input and output channels into
+// `space`, making a contiguous tensor laid out the same way as the full
+// weights. `space` must hold in_channels * out_channels filters.
+static filter_config_t gather_weights(const conv_shape_t* shape,
+                                      const sparse_buffers_t* buffers,
+                                      const conv_task_t* task,
+                                      data_t* space) {
+  int in_count = task->last_in_channel - task->first_in_channel;
+  int out_count = task->last_out_channel - task->first_out_channel;
+  int filter_size = shape->filter_width * shape->filter_height;
+
+  filter_config_t packed;
+  init_weights_sparse(&packed, in_count, out_count, shape->filter_height,
+                      shape->filter_width);
+  packed.data.memory_config = buffers->weights.data.memory_config;
+  packed.data.address = space;
+
+  // Each filter is a contiguous block of filter_size elements.
+  for (int i=0; i<in_count; i++) {
+    int in_c = buffers->input.channels[task->first_in_channel + i];
+
+    for (int o=0; o<out_count; o++) {
+      int out_c = buffers->output.channels[task->first_out_channel + o];
+
+      filter_config_t src = weight_slice(&buffers->weights, &buffers->weight_blocks,
+                                         in_c, in_c+1, out_c, out_c+1);
+      filter_config_t dst = weight_slice(&packed, NULL, i, i+1, o, o+1);
+      memcpy(dst.data.address, src.data.address, filter_size * sizeof(data_t));
+    }
+  }
+
+  return packed;
+}
+
+static void sparse_conv_gather(const conv_shape_t* shape,
+                               sparse_buffers_t* buffers,
+                               const test_options_t* options,
+                               conv_task_t task) {
+  int num_tiles = options->num_tiles;
+
+  // Step 5: sparse convolution.
+  // 'gather' mode: copy the filters for all computed channel pairs into a
+  //                compact tensor, then perform a dense convolution for each
+  //                band of output rows. Every band uses all of the task's
+  //                channels, so only rows which haven't been started can be
+  //                given away.
+
+  conv_queue_t accelerator;
+  init_conv_queue(&accelerator, options->async_conv);
 
-        i += unit.in_channels;
+#ifdef LOAD_BALANCE
+  lb_state_t load_balance;
+  init_lb_state(&load_balance, shape, buffers, options, STRATEGY_GATHER, &task);
+
+  while (!lb_finished(&load_balance)) {
+#endif
+
+    if (task.last_out_channel > task.first_out_channel &&
+        task.last_in_channel > task.first_in_channel &&
+        task.last_row > task.first_row) {
+      int filters = (task.last_in_channel - task.first_in_channel) *
+                    (task.last_out_channel - task.first_out_channel);
+      data_t* space = loki_malloc(filters * shape->filter_width *
+                                  shape->filter_height * sizeof(data_t));
+      assert(space != NULL);
+      conv_task_t gathered = task;
+      filter_config_t packed = gather_weights(shape, buffers, &gathered, space);
+
+      for (int row=task.first_row, row_end; row<task.last_row; row=row_end) {
+        row_end = band_end(&task, row, task.last_out_channel, num_tiles);
+        conv_task_t current = task;
+        current.first_row = row;
+        current.last_row = row_end;
+#ifdef LOAD_BALANCE
+        // Core 1 may have given these rows away, or before the first band,
+        // some of the channels.
+        if (!claim_work(&load_balance, &task, &current))
+          break;
+        row_end = current.last_row;
+#endif
+
+        activation_config_t band_input = input_row_slice(&buffers->input.dense,
+                                                         shape, current.first_row);
+        activation_config_t band_output = output_row_slice(&buffers->output.dense,
+                                                           current.first_row);
 
+        conv_command_t conv;
+        conv.input = activation_slice(&band_input, current.first_in_channel,
+                                      current.last_in_channel);
+        conv.weights = weight_slice(&packed, NULL,
+            current.first_in_channel - gathered.first_in_channel,
+            current.last_in_channel - gathered.first_in_channel,
+            current.first_out_channel - gathered.first_out_channel,
+            current.last_out_channel - gathered.first_out_channel);
+        conv.output = activation_slice(&band_output, current.first_out_channel,
+                                       current.last_out_channel);
+        conv.shape = get_conv_slice(shape, &current);
+        conv.loop_nest = tuned_loop_nest(&conv.shape, &LOOP_NEST_MANY_CHANNELS);
+
+        // Prepare the next band while earlier ones run. This band has work
+        // queued, so must be kept.
+        do {
 #ifdef LOAD_BALANCE
-        // Give up any spare work, if requested.
-        // TODO: Do this while waiting on the accelerator.
-        check_load_balance_requests(&task, &load_balance, i, o);
+          check_load_balance_requests(&task, &load_balance, &current);
 #endif
+        } while (conv_queue_full(&accelerator));
+
+        conv_submit(&accelerator, &conv);
       }
 
-      o += unit.out_channels;
+      // The gathered filters are in use until every band has finished.
+      conv_wait(&accelerator);
+      loki_free(space);
+    }
+
+#ifdef LOAD_BALANCE
+    // Request new work from another tile. This will update `task`.
+    make_load_balance_request(&task, &load_balance, num_tiles);
+
+  }
+
+  // Ensure we respond to any outstanding requests.
+  lb_sync(&load_balance);
+#endif
+
+  delete_conv_queue(&accelerator);
+
+}
+
+// Number of dense channels in each direction of a block in 'hybrid' mode, if
+// the weights are not blocked. Otherwise, the weight blocks are used.
+#define HYBRID_BLOCK_SIZE 16
+
+// Packed weights may still be in use by queued convolutions, so rotate
+// between enough buffers that the oldest is always free.
+#define HYBRID_SCRATCH_BUFFERS (CONV_QUEUE_DEPTH + 1)
+
+// Return the end of the group of compressed channels, starting at `first`,
+// which are in the same block.
+static int block_end(const sparse_activations_t* tensor, int first, int last,
+                     int block_size) {
+  int block = tensor->channels[first] / block_size;
+  int end = first + 1;
+  while (end < last && tensor->channels[end] / block_size == block)
+    end++;
+  return end;
+}
+
+// Return the number of consecutive channels starting at compressed channel
+// `first`.
+static int run_length(const sparse_activations_t* tensor, int first, int last) {
+  int length = 1;
+  while (first + length < last &&
+         tensor->channels[first + length] == tensor->channels[first] + length)
+    length++;
+  return length;
+}
+
+// Queue a convolution, handling load balancing requests while waiting for
+// space. `current` has work queued, so must be kept.
+static void issue_conv(conv_queue_t* queue, conv_command_t* conv,
+                       conv_task_t* task, lb_state_t* load_balance,
+                       const conv_task_t* current) {
+  do {
+#ifdef LOAD_BALANCE
+    check_load_balance_requests(task, load_balance, current);
+#endif
+  } while (conv_queue_full(queue));
+
+  conv_submit(queue, conv);
+}
+
+static void sparse_conv_hybrid(const conv_shape_t* shape,
+                               sparse_buffers_t* buffers,
+                               const test_options_t* options,
+                               conv_task_t task) {
+  int num_tiles = options->num_tiles;
+
+  // Step 5: sparse convolution.
+  // 'hybrid' mode: split the weights into blocks of input and output channels.
+  //                If enough of a block's channels are computed, gather its
+  //                filters and apply them with one dense convolution, as in
+  //                'none' mode. Otherwise, use the runs of consecutive channels
+  //                in the block, as in 'adaptive' mode.
+  int block_size = buffers->weight_blocks.block_size;
+  if (block_size == 0)
+    block_size = HYBRID_BLOCK_SIZE;
+
+  int filter_size = shape->filter_width * shape->filter_height;
+  data_t* scratch[HYBRID_SCRATCH_BUFFERS];
+  for (int b=0; b<HYBRID_SCRATCH_BUFFERS; b++) {
+    scratch[b] = loki_malloc(block_size * block_size * filter_size * sizeof(data_t));
+    assert(scratch[b] != NULL);
+  }
+  int next_scratch = 0;
+
+  conv_shape_t unit = *shape;
+  unit.batch_size = 1;
+
+  conv_queue_t accelerator;
+  init_conv_queue(&accelerator, options->async_conv);
+
+  lb_state_t load_balance;
+#ifdef LOAD_BALANCE
+  init_lb_state(&load_balance, shape, buffers, options, STRATEGY_ADAPTIVE, &task);
+
+  while (!lb_finished(&load_balance)) {
+#endif
+
+    // [o0, o1) and [i0, i1) are the compressed channels in one block.
+    for (int o0=task.first_out_channel, o1; o0<task.last_out_channel; o0=o1) {
+      o1 = block_end(&buffers->output, o0, task.last_out_channel, block_size);
+      int out_block = buffers->output.channels[o0] / block_size;
+      int out_width = shape->out_channels - out_block * block_size;
+      if (out_width > block_size)
+        out_width = block_size;
+
+      for (int row=task.first_row, row_end; row<task.last_row; row=row_end) {
+        row_end = band_end(&task, row, o1, num_tiles);
+        conv_task_t current = {
+          .first_in_channel = task.first_in_channel,
+          .last_in_channel = task.last_in_channel,
+          .first_out_channel = o0, .last_out_channel = o1,
+          .first_row = row, .last_row = row_end,
+          .partial_sums = task.partial_sums
+        };
+#ifdef LOAD_BALANCE
+        // Core 1 may have given some of this work away.
+        if (!claim_work(&load_balance, &task, &current))
+          break;
+        o1 = current.last_out_channel;
+        row_end = current.last_row;
+#endif
+
+        conv_shape_t band = get_row_band_shape(&unit, row, row_end);
+        activation_config_t band_input = input_row_slice(&buffers->input.dense, &unit, row);
+        activation_config_t band_output = output_row_slice(&buffers->output.dense, row);
+
+        for (int i0=task.first_in_channel, i1; i0<task.last_in_channel; i0=i1) {
+          i1 = block_end(&buffers->input, i0, task.last_in_channel, block_size);
+          current.first_in_channel = i0;
+          int in_block = buffers->input.channels[i0] / block_size;
+          int in_width = shape->in_channels - in_block * block_size;
+          if (in_width > block_size)
+            in_width = block_size;
+
+          int active = (o1 - o0) * (i1 - i0);
+          int capacity = out_width * in_width;
+
+          if (active * 100 >= options->dense_threshold * capacity) {
+            // Dense: one convolution for the whole block. If every channel is
+            // computed, the filters are already contiguous.
+            conv_command_t conv;
+            conv_task_t block = {
+              .first_in_channel = i0, .last_in_channel = i1,
+              .first_out_channel = o0, .last_out_channel = o1,
+              .first_row = row, .last_row = row_end,
+              .partial_sums = task.partial_sums
+            };
+
+            if (active == capacity) {
+              int in_c = buffers->input.channels[i0];
+              int out_c = buffers->output.channels[o0];
+              conv.weights = weight_slice(&buffers->weights, &buffers->weight_blocks,
+                                          in_c, in_c + in_width, out_c, out_c + out_width);
+            }
+            else {
+              conv.weights = gather_weights(shape, buffers, &block, scratch[next_scratch]);
+              next_scratch = (next_scratch + 1) % HYBRID_SCRATCH_BUFFERS;
+            }
+
+            conv.input = activation_slice(&band_input, i0, i1);
+            conv.output = activation_slice(&band_output, o0, o1);
+            conv.shape = get_conv_slice(&unit, &block);
+            conv.loop_nest = tuned_loop_nest(&conv.shape, &LOOP_NEST_MANY_CHANNELS);
+
+            issue_conv(&accelerator, &conv, &task, &load_balance, &current);
+          }
+          else {
+            // Sparse: one convolution per pair of runs.
+            for (int o=o0, o_length; o<o1; o+=o_length) {
+              o_length = run_length(&buffers->output, o, o1);
+
+              for (int i=i0, i_length; i<i1; i+=i_length) {
+                i_length = run_length(&buffers->input, i, i1);
+
+                int out_c = buffers->output.channels[o];
+                int in_c = buffers->input.channels[i];
+
+                conv_command_t conv;
+                conv.input = activation_slice(&band_input, i, i+i_length);
+                conv.weights = weight_slice(&buffers->weights, &buffers->weight_blocks,
+                                            in_c, in_c+i_length, out_c, out_c+o_length);
+                conv.output = activation_slice(&band_output, o, o+o_length);
+                conv.shape = band;
+                conv.shape.in_channels = i_length;
+                conv.shape.out_channels = o_length;
+                conv.loop_nest = tuned_loop_nest(&conv.shape, &LOOP_NEST_FEW_CHANNELS);
+
+                issue_conv(&accelerator, &conv, &task, &load_balance, &current);
+              }
+            }
+          }
+        }
+      }
     }
 
 #ifdef LOAD_BALANCE
-    // Request new work from a neighbouring tile. This will update `task`.
+    // Request new work from another tile. This will update `task`.
     make_load_balance_request(&task, &load_balance, num_tiles);
 
   }
@@ -336,4 +950,89 @@ void test_adaptive(const conv_shape_t* shape, void* data,
   lb_sync(&load_balance);
 #endif
 
+  delete_conv_queue(&accelerator);
+
+  for (int b=0; b<HYBRID_SCRATCH_BUFFERS; b++)
+    loki_free(scratch[b]);
+
+}
+
+static void sparse_conv_auto(const conv_shape_t* shape,
+                             sparse_buffers_t* buffers,
+                             const test_options_t* options,
+                             conv_task_t task) {
+  // 'auto' mode: predict the cost of each mode for this tile's work, and use
+  //              the cheapest. Tiles may choose differently, but all modes
+  //              share a load balancing protocol, so can still trade work.
+  strategy_t strategy = choose_strategy(&options->cost_model, shape, buffers, &task);
+
+  if (tile2int(get_tile_id()) == 0)
+    printf("Tile 0 chose '%s' mode\n", strategy_name(strategy));
+
+  switch (strategy) {
+    case STRATEGY_SIMPLE:
+    default:
+      sparse_conv_simple(shape, buffers, options, task);
+      break;
+    case STRATEGY_ADAPTIVE:
+      sparse_conv_adaptive(shape, buffers, options, task);
+      break;
+    case STRATEGY_GATHER:
+      sparse_conv_gather(shape, buffers, options, task);
+      break;
+  }
+}
+
+typedef void sparse_conv_fn(const conv_shape_t* shape, sparse_buffers_t* buffers,
+                            const test_options_t* options, conv_task_t task);
+
+// All steps of a sparse test, using `conv` for step 5.
+static void sparse_test(const conv_shape_t* shape, void* data,
+                        const test_options_t* options, sparse_conv_fn* conv) {
+  sparse_buffers_t* buffers = (sparse_buffers_t*)data;
+  reduction_t reduction;
+  conv_task_t task = compute_gating(shape, buffers, options, &reduction);
+
+  // Only the first tile of a reduction writes to the real output. The others
+  // compute partial sums in their own buffers, which have the same layout.
+  sparse_buffers_t local = *buffers;
+  if (tile2int(get_tile_id()) != reduction.first_tile)
+    local.output.dense.data.address = buffers->partial_sums[tile2int(get_tile_id())];
+
+  unsigned long start = get_cycle_count();
+  conv(shape, &local, options, task);
+  start = profile_phase(PHASE_CONV, start);
+
+  if (reduction.size > 1) {
+    int channel_size = buffers->output.dense.channel_stride / sizeof(data_t);
+    reduce_partial_sums(&reduction, local.output.dense.data.address,
+                        task.first_out_channel * channel_size,
+                        (task.last_out_channel - task.first_out_channel) * channel_size);
+    profile_phase(PHASE_REDUCE, start);
+  }
+}
+
+void test_simple(const conv_shape_t* shape, void* data,
+                 const test_options_t* options) {
+  sparse_test(shape, data, options, sparse_conv_simple);
+}
+
+void test_adaptive(const conv_shape_t* shape, void* data,
+                   const test_options_t* options) {
+  sparse_test(shape, data, options, sparse_conv_adaptive);
+}
+
+void test_gather(const conv_shape_t* shape, void* data,
+                 const test_options_t* options) {
+  sparse_test(shape, data, options, sparse_conv_gather);
+}
+
+void test_hybrid(const conv_shape_t* shape, void* data,
+                 const test_options_t* options) {
+  sparse_test(shape, data, options, sparse_conv_hybrid);
+}
+
+void test_auto(const conv_shape_t* shape, void* data,
+               const test_options_t* options) {
+  sparse_test(shape, data, options, sparse_conv_auto);
 }
@@ -0,0 +1,194 @@
+// Analytical model of how long each sparse mode takes to perform a task.
+//
+// Every convolution has a fixed cost to set up and issue, plus a cost per
+// multiply-accumulate which depends on the loop nest used. 'gather' mode also
+// pays to copy the filters it needs. Costs per MAC and per copied weight are
+// held in units of 1/COST_SCALE cycles, to avoid floating point.
+
+#include <stdio.h>
+#include <loki/alloc.h>
+#include <nn/layers.h>
+#include "defs.h"
+
+#define COST_SCALE 1024
+
+// Rough values for lokisim. Use --calibrate to measure them instead.
+const cost_model_t DEFAULT_COST_MODEL = {
+  .launch = 2000,
+  .mac_few = 1024,
+  .mac_many = 256,
+  .copy = 4096
+};
+
+// Number of convolutions needed to cover compressed channels [first, last) in
+// 'adaptive' mode: a new one starts wherever consecutive channels are not
+// adjacent, or cross a weight block boundary.
+static int count_pieces(const sparse_activations_t* tensor,
+                        const weight_blocks_t* blocks, int first, int last) {
+  int pieces = 0;
+
+  for (int i=first; i<last; i++) {
+    bool adjacent = (i > first) && (tensor->channels[i] == tensor->channels[i-1] + 1);
+    bool new_block = (blocks->block_size > 0) &&
+                     (tensor->channels[i] % blocks->block_size == 0);
+    if (!adjacent || new_block)
+      pieces++;
+  }
+
+  return pieces;
+}
+
+unsigned long predict_cycles(const cost_model_t* model, strategy_t strategy,
+                             const conv_shape_t* shape,
+                             const sparse_buffers_t* buffers,
+                             const conv_task_t* task) {
+  unsigned long in_channels = task->last_in_channel - task->first_in_channel;
+  unsigned long out_channels = task->last_out_channel - task->first_out_channel;
+  if (task->last_in_channel <= task->first_in_channel ||
+      task->last_out_channel <= task->first_out_channel ||
+      task->last_row <= task->first_row)
+    return 0;
+
+  unsigned long filter_size = shape->filter_width * shape->filter_height;
+  unsigned long out_width = shape->image_width - shape->filter_width + 1;
+  unsigned long out_height = task->last_row - task->first_row;
+  unsigned long filters = in_channels * out_channels;
+  unsigned long macs = filters * filter_size * out_width * out_height;
+
+  switch (strategy) {
+    case STRATEGY_SIMPLE:
+      return filters * model->launch + macs * model->mac_few / COST_SCALE;
+
+    case STRATEGY_ADAPTIVE: {
+      unsigned long in_pieces = count_pieces(&buffers->input, &buffers->weight_blocks,
+                                             task->first_in_channel, task->last_in_channel);
+      unsigned long out_pieces = count_pieces(&buffers->output, &buffers->weight_blocks,
+                                              task->first_out_channel, task->last_out_channel);
+      return in_pieces * out_pieces * model->launch + macs * model->mac_few / COST_SCALE;
+    }
+
+    case STRATEGY_GATHER:
+      return model->launch + filters * filter_size * model->copy / COST_SCALE
+           + macs * model->mac_many / COST_SCALE;
+
+    default:
+      return 0;
+  }
+}
+
+strategy_t choose_strategy(const cost_model_t* model, const conv_shape_t* shape,
+                           const sparse_buffers_t* buffers,
+                           const conv_task_t* task) {
+  strategy_t best = STRATEGY_SIMPLE;
+  unsigned long best_cycles = predict_cycles(model, best, shape, buffers, task);
+
+  for (strategy_t s=STRATEGY_SIMPLE; s<NUM_STRATEGIES; s++) {
+    unsigned long cycles = predict_cycles(model, s, shape, buffers, task);
+    if (cycles < best_cycles) {
+      best = s;
+      best_cycles = cycles;
+    }
+  }
+
+  return best;
+}
+
+const char* strategy_name(strategy_t strategy) {
+  switch (strategy) {
+    case STRATEGY_SIMPLE: return "simple";
+    case STRATEGY_ADAPTIVE: return "adaptive";
+    case STRATEGY_GATHER: return "gather";
+    default: return "unknown";
+  }
+}
+
+
+// Calibration: time convolutions of two different sizes with each loop nest,
+// and fit a straight line through them. The intercept is the launch cost, and
+// the gradient is the cost per MAC.
+
+#define CALIBRATION_IMAGE 16
+#define CALIBRATION_FILTER 3
+#define CALIBRATION_REPEATS 5
+
+// Time a convolution of `channels` inputs to `channels` outputs.
+static unsigned long time_square_conv(int channels, const loop_nest_t* loop_nest) {
+  conv_shape_t shape = {
+    .batch_size = 1, .in_channels = channels, .out_channels = channels,
+    .image_width = CALIBRATION_IMAGE, .image_height = CALIBRATION_IMAGE,
+    .filter_width = CALIBRATION_FILTER, .filter_height = CALIBRATION_FILTER,
+    .groups = 1, .stride = 1, .dilation = 1
+  };
+  return time_conv(&shape, loop_nest);
+}
+
+static unsigned long conv_macs(int channels) {
+  int out_size = CALIBRATION_IMAGE - CALIBRATION_FILTER + 1;
+  return (unsigned long)channels * channels * out_size * out_size *
+         CALIBRATION_FILTER * CALIBRATION_FILTER;
+}
+
+// Fit cycles = launch + macs * gradient / COST_SCALE through two points.
+// `launch` may be NULL if only the gradient is needed.
+static void fit_line(int small, int large, const loop_nest_t* loop_nest,
+                     unsigned int* launch, unsigned int* gradient) {
+  unsigned long small_cycles = time_square_conv(small, loop_nest);
+  unsigned long large_cycles = time_square_conv(large, loop_nest);
+  unsigned long small_macs = conv_macs(small);
+  unsigned long large_macs = conv_macs(large);
+
+  unsigned long slope = (large_cycles > small_cycles)
+      ? (large_cycles - small_cycles) * COST_SCALE / (large_macs - small_macs)
+      : 0;
+  unsigned long fixed = small_macs * slope / COST_SCALE;
+
+  *gradient = slope;
+  if (launch != NULL)
+    *launch = (small_cycles > fixed) ? small_cycles - fixed : 0;
+}
+
+// Time copying filters the way 'gather' mode does.
+static unsigned int time_copy(void) {
+  const int filters = 1024;
+  const int filter_size = CALIBRATION_FILTER * CALIBRATION_FILTER;
+  data_t* src = loki_malloc(filters * filter_size * sizeof(data_t));
+  data_t* dst = loki_malloc(filters * filter_size * sizeof(data_t));
+  assert(src != NULL && dst != NULL);
+
+  unsigned long best = ~0ul;
+  for (int repeat=0; repeat<CALIBRATION_REPEATS; repeat++) {
+    unsigned long start = get_cycle_count();
+    // Filters are read in a scattered order, as in the full weight tensor.
+    for (int f=0; f<filters; f++) {
+      int from = (f * 37) % filters;
+      for (int i=0; i<filter_size; i++)
+        dst[f * filter_size + i] = src[from * filter_size + i];
+    }
+    unsigned long duration = get_cycle_count() - start;
+    if (duration < best)
+      best = duration;
+  }
+
+  loki_free(src);
+  loki_free(dst);
+
+  return best * COST_SCALE / (filters * filter_size);
+}
+
+void calibrate_cost_model(cost_model_t* model) {
+  // The model has one launch cost, which is dominated by the many small
+  // convolutions of the sparse modes.
+  fit_line(1, 8, &LOOP_NEST_FEW_CHANNELS, &model->launch, &model->mac_few);
+  fit_line(8, 32, &LOOP_NEST_MANY_CHANNELS, NULL, &model->mac_many);
+  model->copy = time_copy();
+}
+
+bool parse_cost_model(const char* text, cost_model_t* model) {
+  return sscanf(text, "%u,%u,%u,%u", &model->launch, &model->mac_few,
+                &model->mac_many, &model->copy) == 4;
+}
+
+void print_cost_model(const cost_model_t* model) {
+  printf("--cost-model=%u,%u,%u,%u\n", model->launch, model->mac_few,
+         model->mac_many, model->copy);
+}
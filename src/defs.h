@@ -3,14 +3,54 @@
 
 #include <nn/layers.h>
 
+// Set of dense channels which are present in a sparse tensor, with the
+// number of channels before each word, so ranks take constant time.
+typedef struct {
+  unsigned long long* words; // Bit c is set if dense channel c is stored.
+  int* rank;                 // Stored channels before each word.
+  int num_words;
+} channel_bitmap_t;
+
 // A compressed sparse tensor, with only the selected channels stored.
 // Stored channels are stored in the normal dense way.
 typedef struct {
   activation_config_t dense;
   int* channels;
   int num_channels;
+
+  // Optional index of `channels` for the whole tensor, shared by all slices.
+  // `offset` is the position of this slice's first channel in the whole
+  // tensor. Only the input and its downsampled copy have one, since they are
+  // sliced by dense channel. The output's channels are chosen during each run,
+  // and the sparse modes only index it by compressed channel, so it has none;
+  // slicing it by dense channel searches the channel list.
+  const channel_bitmap_t* bitmap;
+  int offset;
 } sparse_activations_t;
 
+// A run of compressed channels which are also consecutive in the dense
+// tensor, so can be processed by a single multi-channel operation.
+typedef struct {
+  int first;  // compressed index
+  int length;
+} channel_run_t;
+
+// All runs in a range of a sparse tensor, in order.
+typedef struct {
+  channel_run_t* runs;
+  int num_runs;
+} channel_runs_t;
+
+// Optional blocking of a weight tensor. Channels are grouped into blocks of
+// `block_size` output channels by `block_size` input channels, and each block
+// is stored contiguously, so filters for a run of consecutive channels are
+// close together. The filter_config_t holds strides within a block.
+typedef struct {
+  int block_size;       // 0 if the tensor is not blocked.
+  int in_block_stride;  // bytes
+  int out_block_stride; // bytes
+} weight_blocks_t;
+
 // All data buffers required for a dense computation.
 typedef struct {
   activation_config_t input;
@@ -22,39 +62,160 @@ typedef struct {
 typedef struct {
   sparse_activations_t input;
   filter_config_t weights;
+  weight_blocks_t weight_blocks;
   sparse_activations_t output;
+  channel_runs_t input_runs;
 
   sparse_activations_t input_downsampled;
   dense_buffers_t* auxiliary;
+
+  // Each tile's buffer of partial sums, when tiles share output channels and
+  // split the input channels between them (see partition_t). Laid out like
+  // `output`. NULL for tiles with no buffer.
+  data_t** partial_sums;
+  int num_partial_sums;
 } sparse_buffers_t;
 
+// How steps 3+4 choose which output channels to compute.
+typedef enum {
+  // Use a predetermined random sequence instead of the auxiliary output. This
+  // gives precise control over the sparsity achieved.
+  GATING_RANDOM,
+
+  // Compute channels whose auxiliary output is above `gate_threshold`.
+  GATING_THRESHOLD,
+
+  // Compute the channels with the largest auxiliary outputs, keeping
+  // (100 - out_sparsity)% of all channels.
+  GATING_TOP_K
+} gating_t;
+
+// How the sparse convolution is first shared between tiles.
+typedef enum {
+  // Choose using the numbers of active input and output channels.
+  PARTITION_AUTO,
+
+  // Each tile computes some output channels from all input channels. If there
+  // are fewer output channels than tiles, their rows are split instead.
+  PARTITION_OUTPUT,
+
+  // Each tile computes all output channels from some input channels. Partial
+  // sums are added together afterwards.
+  PARTITION_INPUT,
+
+  // Groups of tiles each compute some output channels, and the tiles in a
+  // group split the input channels between them.
+  PARTITION_2D
+} partition_t;
+
+// Constants for predicting how long each sparse mode will take. Per-unit costs
+// are in 1/1024ths of a cycle.
+typedef struct {
+  unsigned int launch;   // cycles to set up and issue one convolution
+  unsigned int mac_few;  // per MAC, using LOOP_NEST_FEW_CHANNELS
+  unsigned int mac_many; // per MAC, using LOOP_NEST_MANY_CHANNELS
+  unsigned int copy;     // per weight copied by 'gather' mode
+} cost_model_t;
+
+extern const cost_model_t DEFAULT_COST_MODEL;
+
+// Everything about a test other than the layer shape and its data.
+typedef struct {
+  int in_sparsity;  // percentage
+  int out_sparsity; // percentage
+  gating_t gating;
+  data_t gate_threshold;
+  bool async_conv;  // Issue convolutions from core 1 (see conv_queue_t).
+  bool lb_server;   // Core 1 answers load balancing requests (see lb_state_t).
+  int weight_block_size; // Sparse weight blocking (see weight_blocks_t).
+  cost_model_t cost_model; // Used by 'auto' mode.
+  int dense_threshold;     // percentage: used by 'hybrid' mode.
+  partition_t partition;
+  int num_tiles;
+} test_options_t;
+
 // Function to set up cores on remote tiles. Must be called before any
-// computation is performed.
+// computation is performed. Tiles are set up in parallel, using a broadcast
+// tree.
 void init(int num_tiles);
 
 typedef void test_fn(const conv_shape_t* shape, void* data,
-                     int in_sparsity, int out_sparsity, int num_tiles);
+                     const test_options_t* options);
 test_fn test_none;
 test_fn test_simple;
 test_fn test_adaptive;
+test_fn test_gather;
+test_fn test_hybrid;
+test_fn test_auto;
+
+// Loop orders for the accelerator.
+extern loop_nest_t LOOP_NEST_MANY_CHANNELS;
+extern loop_nest_t LOOP_NEST_FEW_CHANNELS;
 
 void* init_dense_buffers(const conv_shape_t* shape);
-void* init_sparse_buffers(const conv_shape_t* shape, int in_sparsity);
+void* init_sparse_buffers(const conv_shape_t* shape, const test_options_t* options);
 
 typedef void dealloc_fn(void* buffers);
 dealloc_fn delete_dense_buffers;
 dealloc_fn delete_sparse_buffers;
 
+// Clear the outputs so the same buffers can be used for another run.
+typedef void reset_fn(void* buffers, const conv_shape_t* shape);
+reset_fn reset_dense_buffers;
+reset_fn reset_sparse_buffers;
+
+// Fill inputs and weights with known values, so results can be checked (see
+// check.c).
+typedef void fill_fn(void* buffers, const conv_shape_t* shape);
+fill_fn fill_dense_buffers;
+fill_fn fill_sparse_buffers;
+
+// Summarise the computed output channels.
+typedef unsigned int checksum_fn(void* buffers, const conv_shape_t* shape);
+checksum_fn checksum_dense_buffers;
+checksum_fn checksum_sparse_buffers;
+
+// The same checksum, computed from a naive convolution of the known values.
+checksum_fn reference_checksum_dense_buffers;
+checksum_fn reference_checksum_sparse_buffers;
+
+
+// Set the strides of a sparse activation tensor, and its channel count.
+// Dimension order is BCHW.
+void init_sparse(sparse_activations_t* a,
+                 int batch_size, int channels, int height, int width);
+
+// Set the strides of a weight tensor used by the sparse modes. Dimension order
+// is OIHW.
+void init_weights_sparse(filter_config_t* f, int in_channels, int out_channels,
+                         int filter_height, int filter_width);
+
+// As init_weights_sparse, but optionally blocked. Return the number of
+// elements to allocate.
+int init_weights_blocked(filter_config_t* f, weight_blocks_t* blocks,
+                         int block_size, int in_channels, int out_channels,
+                         int filter_height, int filter_width);
+
+// Fill an array with small pseudo-random values.
+void fill_random(data_t* data, int count);
+
 
 // TASKS - breaking a computation into smaller units.
 
-// For now, all tasks are defined over an integer number of channels.
-// Could also split the work up spatially.
+// Convolution tasks are defined over an integer number of channels, and a band
+// of output rows. A band of rows reads filter_height - 1 more input rows than
+// it produces (the halo), which overlap with the neighbouring bands' inputs.
 typedef struct {
   int first_in_channel;  // inclusive
   int last_in_channel;   // exclusive
   int first_out_channel; // inclusive
   int last_out_channel;  // exclusive
+  int first_row;         // inclusive, output rows
+  int last_row;          // exclusive
+
+  // The task has only some of the layer's input channels, so computes partial
+  // sums which must be combined with other tiles'. It can't be given away.
+  bool partial_sums;
 } conv_task_t;
 
 typedef struct {
@@ -67,12 +228,41 @@ typedef struct {
 conv_task_t get_tile_conv_task(const conv_shape_t* shape, int tile, int num_tiles);
 pool_task_t get_tile_pool_task(const pool_shape_t* shape, int tile, int num_tiles);
 
+// Split a layer between tiles so that each gets an equal share of the channels
+// stored in `tensor`, rather than of all channels.
+pool_task_t get_sparse_pool_task(const sparse_activations_t* tensor,
+                                 const pool_shape_t* shape, int tile,
+                                 int num_tiles);
+
 activation_config_t activation_slice(const activation_config_t* tensor,
                                      int first_channel, int last_channel);
+// `blocks` may be NULL if the tensor is not blocked. Otherwise, the slice must
+// not cross a block boundary.
 filter_config_t weight_slice(const filter_config_t* tensor,
+                             const weight_blocks_t* blocks,
                              int first_in_channel, int last_in_channel,
                              int first_out_channel, int last_out_channel);
 
+// Return how many of `length` consecutive channels, starting at `channel`, can
+// be sliced together without crossing a block boundary.
+int weight_block_run(const weight_blocks_t* blocks, int channel, int length);
+
+// Number of rows of the layer's output.
+int conv_output_rows(const conv_shape_t* shape);
+
+// Shape of the convolution producing output rows [first_row, last_row),
+// including the input halo.
+conv_shape_t get_row_band_shape(const conv_shape_t* shape, int first_row,
+                                int last_row);
+
+// Move the start of a tensor slice down to the first input row needed for
+// output row `first_row`, or to output row `first_row`.
+activation_config_t input_row_slice(const activation_config_t* tensor,
+                                    const conv_shape_t* shape, int first_row);
+activation_config_t output_row_slice(const activation_config_t* tensor,
+                                     int first_row);
+
+// Includes the task's rows.
 conv_shape_t get_conv_slice(const conv_shape_t* shape, const conv_task_t* task);
 pool_shape_t get_pool_slice(const pool_shape_t* shape, const pool_task_t* task);
 
@@ -100,30 +290,384 @@ pool_sparse_act_slice_fn get_sparse_input_pool_slice;
 pool_sparse_act_slice_fn get_sparse_output_pool_slice;
 
 
+// Build a bitmap of the given dense channels, which must be in increasing
+// order and less than `dense_channels`.
+void init_channel_bitmap(channel_bitmap_t* bitmap, const int* channels,
+                         int num_channels, int dense_channels);
+void delete_channel_bitmap(channel_bitmap_t* bitmap);
+
+// Return the number of stored channels with dense index below `channel`. This
+// is also the compressed index of `channel`, if it is stored.
+int channel_rank(const channel_bitmap_t* bitmap, int channel);
+
+// Find the runs of consecutive channels among compressed channels
+// [first, last) of `tensor`.
+void init_channel_runs(channel_runs_t* runs, const sparse_activations_t* tensor,
+                       int first, int last);
+void delete_channel_runs(channel_runs_t* runs);
+
+// Discard everything from compressed channel `last` onwards. Used when part of
+// a task is given away.
+void truncate_channel_runs(channel_runs_t* runs, int last);
+
+// Return the index of the run holding compressed channel `channel`, or of the
+// first run after it.
+int find_channel_run(const channel_runs_t* runs, int channel);
+
+
+// Choose which of the task's output channels to compute. Dense channel indices
+// are written to `channels`, and the number of channels is returned. Top-k
+// gating ranks all of the layer's channels, so needs the auxiliary outputs of
+// every tile.
+int select_output_channels(const conv_shape_t* shape,
+                           const sparse_buffers_t* buffers,
+                           const conv_task_t* task,
+                           const test_options_t* options,
+                           int* channels);
+
+
+// COST MODEL - choosing a sparse mode automatically.
+
+typedef enum {
+  STRATEGY_SIMPLE,
+  STRATEGY_ADAPTIVE,
+  STRATEGY_GATHER,
+  NUM_STRATEGIES
+} strategy_t;
+
+// Predict how long step 5 of the given mode would take to complete `task`.
+unsigned long predict_cycles(const cost_model_t* model, strategy_t strategy,
+                             const conv_shape_t* shape,
+                             const sparse_buffers_t* buffers,
+                             const conv_task_t* task);
+
+// Return the mode with the lowest predicted cost for `task`.
+strategy_t choose_strategy(const cost_model_t* model, const conv_shape_t* shape,
+                           const sparse_buffers_t* buffers,
+                           const conv_task_t* task);
+
+const char* strategy_name(strategy_t strategy);
+
+// Fit the model's constants by timing convolutions on this tile.
+void calibrate_cost_model(cost_model_t* model);
+
+// Read/write constants in the form "launch,mac_few,mac_many,copy".
+bool parse_cost_model(const char* text, cost_model_t* model);
+void print_cost_model(const cost_model_t* model);
+
+
+// LOOP NESTS - loop orders tuned for each convolution shape (see tuner.c).
+
+#define DEFAULT_LOOP_NEST_FILE "loop_nests.txt"
+
+// Read tuned loop nests from a file, if it exists. Must be called before
+// computation starts.
+void load_loop_nests(const char* filename);
+
+// Return the tuned loop nest for convolutions of this shape, or `fallback` if
+// there isn't one.
+const loop_nest_t* tuned_loop_nest(const conv_shape_t* shape,
+                                   const loop_nest_t* fallback);
+
+// Make tuned_loop_nest remember shapes which have not been tuned. Must be
+// called before computation starts.
+void record_untuned_shapes(int num_tiles);
+
+// Tune every shape recorded since record_untuned_shapes, and save all tuned
+// loop nests to a file. Must be called after computation has finished.
+void tune_loop_nests(const char* filename);
+
+// Return the quickest of several runs of a convolution with the given shape,
+// using the sparse modes' tensor layouts.
+unsigned long time_conv(const conv_shape_t* shape, const loop_nest_t* loop_nest);
+
+
+// BENCHMARKING - repeated runs and parameter sweeps (see main.c, sweep.c).
+
+#define MAX_REPEATS 100
+
+// Run one configuration, given command line arguments as accepted by
+// lat-dynamic (argv[0] is ignored). Store the duration of each run after the
+// warm-up in `durations`, which must have space for MAX_REPEATS, and return
+// how many there were.
+int run_test(int argc, char** argv, unsigned long* durations);
+
+// Sort the durations and find their median, minimum and maximum.
+void summarise_durations(unsigned long* durations, int count,
+                         unsigned long* median, unsigned long* min,
+                         unsigned long* max);
+
+// Run every combination of parameters listed in `grid_file`, and write a line
+// of CSV for each to `csv_file` (stdout if NULL). `extra_args` are added to
+// every configuration.
+void run_sweep(const char* grid_file, const char* csv_file,
+               int num_extra_args, char** extra_args);
+
+
+// PROFILING - time spent in each phase of the computation, per tile.
+
+typedef enum {
+  PHASE_STARTUP,     // From the start of the launch until this tile started.
+  PHASE_DOWNSAMPLE,  // Step 1, including sharing results with other tiles.
+  PHASE_AUXILIARY,   // Step 2.
+  PHASE_GATING,      // Steps 3+4.
+  PHASE_CONV,        // Step 5, including the two load balancing phases below.
+  PHASE_LB_REQUEST,  // Asking other tiles for work.
+  PHASE_LB_SYNC,     // Waiting for all tiles to finish load balancing.
+  PHASE_REDUCE,      // Adding partial sums from other tiles.
+  PHASE_TOTAL,       // Everything, up to the final synchronisation.
+  NUM_PHASES
+} phase_t;
+
+typedef enum {
+  COUNTER_REQUESTS_SENT,
+  COUNTER_EMPTY_RESPONSES, // Requests sent which received no work.
+  COUNTER_REQUESTS_SERVED,
+  COUNTER_WORK_GRANTED,    // Requests served which gave away work.
+  COUNTER_CHANNELS_MIGRATED, // Output channels given away.
+  NUM_COUNTERS
+} counter_t;
+
+// Start recording for `num_tiles` tiles. Until this is called, the functions
+// below do nothing.
+void init_profiles(int num_tiles);
+void delete_profiles(void);
+
+// Clear all counts before another run.
+void reset_profiles(void);
+
+// Add the time since `start` to this tile's `phase`, and return the current
+// time. Phases are also traced.
+unsigned long profile_phase(phase_t phase, unsigned long start);
+
+// Add to one of this tile's counters.
+void profile_count(counter_t counter, int amount);
+
+// Make this tile's counts visible to tile 0. Must be called at the end of
+// each run.
+void flush_profile(void);
+
+// Print a table of every tile's counts.
+void print_profiles(void);
+
+
+// TRACING - timelines of events on each core (see trace.c).
+
+// Start recording for `num_tiles` tiles. Until this is called, the functions
+// below do nothing.
+void init_trace(int num_tiles);
+void delete_trace(void);
+
+// Discard all events before another run.
+void reset_trace(void);
+
+// Record an event on this core which started at `start` and ends now, and
+// return the current time. `name` must be a string constant. `value` is shown
+// with the event.
+unsigned long trace_complete(const char* name, unsigned long start, int value);
+
+// Record an event on this core which has no duration.
+void trace_instant(const char* name, int value);
+
+// Make this core's events visible to tile 0. Must be called by each core at
+// the end of each run.
+void flush_trace(void);
+
+// Write every core's events in Chrome's trace event format.
+void write_trace(const char* filename);
+
+
+// COMMUNICATION - collective operations between tiles.
+
+// Return the sum of `value` over all tiles numbered lower than this one, and
+// store the sum over all tiles in `total`, if it isn't NULL.
+// All tiles in [0, num_tiles) must take part. Values must be non-negative and
+// the total less than 2^24.
+int exclusive_prefix_sum(int value, int num_tiles, int* total);
+
+// All-gather through shared memory: each tile computes part of an array, and
+// every tile needs all of it. Tiles write their parts to the array, then
+// announce which elements are ready. Parts may be published in pieces, so
+// communication can overlap with computing the rest.
+typedef struct {
+  char* array;
+  int element_size;
+  int remaining; // Elements still to be received from other tiles.
+} all_gather_t;
+
+// `expected` is the number of elements which other tiles will publish.
+void all_gather_init(all_gather_t* state, void* array, int element_size,
+                     int expected);
+
+// Make elements [first, first+count) visible to all other tiles.
+void all_gather_publish(all_gather_t* state, int first, int count,
+                        int num_tiles);
+
+// Receive an announcement from another tile, and make the elements it refers
+// to visible to this tile. Return false if all elements have already been
+// received, or if `wait` is false and no announcement is waiting.
+bool all_gather_receive(all_gather_t* state, int* first, int* count, bool wait);
+
+
+// Broadcast tree rooted at tile 0, used to start tiles. Tile t passes the
+// broadcast on to tiles t + step, for step = tree_first_step(t), doubling each
+// time, while they are below the tile count. Every tile which has received the
+// broadcast forwards it at each step, so n tiles are reached in ceil(log2(n))
+// steps.
+int tree_first_step(int tile);
+
+
+// Tree reduction: a group of tiles each hold partial sums, which must be added
+// together. The group is tiles [first_tile, first_tile + size), and the result
+// ends up on the first tile.
+typedef struct {
+  int first_tile;
+  int size;           // 1 if there is nothing to reduce.
+  data_t** partials;  // Buffer of each tile in the group, indexed by tile.
+} reduction_t;
+
+// Add elements [offset, offset + count) of every other tile's buffer into the
+// same elements of `buffer`, which is this tile's buffer, or the result on the
+// first tile. All tiles in the group must take part. The tree has
+// ceil(log2(size)) levels.
+void reduce_partial_sums(const reduction_t* reduction, data_t* buffer,
+                         int offset, int count);
+
+
+// ACCELERATOR - asynchronous convolutions.
+
+// Everything needed to issue one lat_conv2d.
+typedef struct {
+  activation_config_t input;
+  filter_config_t weights;
+  activation_config_t output;
+  conv_shape_t shape;
+  const loop_nest_t* loop_nest;
+} conv_command_t;
+
+// Maximum number of convolutions waiting or in progress on one tile.
+#define CONV_QUEUE_DEPTH 2
+
+// Convolutions submitted by this tile's core 0. If `async` is set, they are
+// issued in order by core 1, leaving core 0 free while they run. Otherwise
+// they are issued immediately and submission blocks.
+typedef struct {
+  bool async;
+  int outstanding;
+  int next_slot;
+  conv_command_t slots[CONV_QUEUE_DEPTH];
+} conv_queue_t;
+
+void init_conv_queue(conv_queue_t* queue, bool async);
+
+// Wait for all convolutions to finish and release core 1.
+void delete_conv_queue(conv_queue_t* queue);
+
+// Queue a convolution. The command is copied, so can be reused immediately.
+// Blocks if the queue is full.
+void conv_submit(conv_queue_t* queue, conv_command_t* command);
+
+// Return whether a call to conv_submit would block. Does not block.
+bool conv_queue_full(conv_queue_t* queue);
+
+// Block until there is space in the queue.
+void conv_wait_for_space(conv_queue_t* queue);
+
+// Block until all submitted convolutions have finished.
+void conv_wait(conv_queue_t* queue);
+
+
 // Load balancing state.
+// Sets of tiles are bitmasks indexed by tile number, so up to 64 tiles are
+// supported. The host backend's grid is smaller.
+#ifdef LOKI_HOST
+#define MAX_TILES LOKI_HOST_MAX_TILES
+#else
+#define MAX_TILES 64
+#endif
+//
+// Requests are answered by core 0 between convolutions, or if `server` is set,
+// by core 1 at any time. Core 1 then gives work away from `shared`, and core 0
+// must claim each piece of work before starting it (see claim_work).
+typedef struct {
+  conv_task_t task;          // Written by core 1 only.
+  conv_task_t next_task;     // Passed from core 0 to core 1.
+
+  // Output channels and rows are claimed and given away with atomic updates,
+  // each of a single word: the limit in the top half, and the next piece to
+  // be claimed in the bottom half. Rows belong to the group of output channels
+  // starting at `group_first`, which is the last group claimed.
+  unsigned int channels;
+  unsigned int rows;
+  int group_first;
+} lb_shared_t;
+
 typedef struct {
+  int num_tiles;
+  int this_tile;
+  unsigned int random;              // Victim selection.
+
+  bool finished;                    // This tile will make no more requests.
+  bool terminated;                  // No tile will make any more requests.
+  unsigned long long no_spare_work; // Tiles not worth asking for work.
+
+  // Termination is detected using a tree of tiles.
+  int parent;
+  int num_children;
+  int children_finished;            // Children whose subtrees have finished.
+
   unsigned int requests_made;
   unsigned int requests_received;
+
+  // Used to estimate how long spare work will take, when deciding how much
+  // to give away.
+  const conv_shape_t* shape;
+  const sparse_buffers_t* buffers;
+  const cost_model_t* cost_model;
+  strategy_t strategy;
+
+  bool server;
+  lb_shared_t shared;
+  int claimed_out;                  // End of the output channels claimed.
 } lb_state_t;
 
-// Initialise the lb_state_t struct.
-void init_lb_state(lb_state_t* state, int num_tiles);
+// Initialise the lb_state_t struct, for a tile starting on `task`. Work is
+// costed as if done by `strategy`. Starts core 1 if `options->lb_server` is
+// set.
+void init_lb_state(lb_state_t* state, const conv_shape_t* shape,
+                   const sparse_buffers_t* buffers, const test_options_t* options,
+                   strategy_t strategy, const conv_task_t* task);
 
 // Check whether all load balancing opportunities have been taken.
 bool lb_finished(const lb_state_t* state);
 
-// Wait until all neighbours have finished. We may need to respond to their
-// requests.
+// Wait until all other tiles have finished. We may need to respond to their
+// requests. Stops core 1, if it is in use.
 void lb_sync(lb_state_t* state);
 
-// Request more work.
+// Request more work from other tiles.
 // Store the resulting task in the given parameter, and return whether there is
 // any work to do.
 bool make_load_balance_request(conv_task_t* task, lb_state_t* state, int num_tiles);
 
-// Iterations are counted within the current task only.
-// TODO: don't really want to pass current iteration counts.
+// Claim `current`, the next piece of `task`, before starting it. If core 1
+// answers requests, parts of the task may have been given away at any time,
+// so `task` is brought up to date and `current` is cut short if necessary.
+// Pieces must be claimed in order. Return false, leaving `current` empty, if
+// none of it is left.
+bool claim_work(lb_state_t* state, conv_task_t* task, conv_task_t* current);
+
+// Give away spare work from `task` if requested. `current` is the part of the
+// task which has been started but not finished, and must be kept.
 void check_load_balance_requests(conv_task_t* task, lb_state_t* state,
-                                 int in_channel_iteration, int out_channel_iteration);
+                                 const conv_task_t* current);
+
+// Split the given task in two. Update the given task to reduce its size, and
+// return the piece that was removed. Output channels after `current` are
+// given away if there are any; otherwise, output rows after `current`. The
+// piece is sized so that both tiles are predicted to finish together, and is
+// empty if it wouldn't be worth moving.
+conv_task_t split_task(const lb_state_t* state, conv_task_t* task,
+                       const conv_task_t* current);
 
 #endif // include guard
@@ -0,0 +1,158 @@
+// Steps 3+4 of the computation: choose which output channels to compute,
+// based on the output of the auxiliary layer.
+
+#include <loki/alloc.h>
+#include <nn/layers.h>
+#include "defs.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// An array of random numbers.
+extern int random_numbers[];
+
+// Append to `channels` every channel c in [first, last) where gate[c] > threshold.
+// `gate` holds one value per dense channel. Return the number of channels
+// appended.
+static int select_above(const data_t* gate, int first, int last,
+                        data_t threshold, int* channels) {
+  int count = 0;
+  int c = first;
+
+#if defined(__AVX2__)
+  // Compare 8 channels at a time, then only visit the ones selected.
+  __m256i limit = _mm256_set1_epi32(threshold);
+  for (; c + 8 <= last; c += 8) {
+    __m256i values = _mm256_loadu_si256((const __m256i*)(gate + c));
+    __m256i above = _mm256_cmpgt_epi32(values, limit);
+    unsigned int mask = _mm256_movemask_ps(_mm256_castsi256_ps(above));
+
+    while (mask) {
+      channels[count++] = c + __builtin_ctz(mask);
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  // Branch-free: always write, only advance if selected.
+  for (; c < last; c++) {
+    channels[count] = c;
+    count += (gate[c] > threshold);
+  }
+
+  return count;
+}
+
+// Rearrange `values` so that values[k-1] is the kth largest, and return it.
+static data_t kth_largest(data_t* values, int length, int k) {
+  int low = 0;
+  int high = length - 1;
+
+  while (low < high) {
+    data_t pivot = values[(low + high) / 2];
+    int i = low;
+    int j = high;
+
+    while (i <= j) {
+      while (values[i] > pivot) i++;
+      while (values[j] < pivot) j--;
+      if (i <= j) {
+        data_t temp = values[i];
+        values[i] = values[j];
+        values[j] = temp;
+        i++;
+        j--;
+      }
+    }
+
+    if (k - 1 <= j)
+      high = j;
+    else if (k - 1 >= i)
+      low = i;
+    else
+      break;
+  }
+
+  return values[k - 1];
+}
+
+// Append to `channels` the k channels in [first, last) with the largest gate
+// values, in channel order. Ties are broken in favour of lower channels.
+static int select_top_k(const data_t* gate, int first, int last, int k,
+                        int* channels) {
+  int length = last - first;
+
+  if (k <= 0)
+    return 0;
+  if (k >= length)
+    return select_above(gate, first, last, INT32_MIN, channels);
+
+  data_t* scratch = loki_malloc(length * sizeof(data_t));
+  assert(scratch != NULL);
+  for (int i=0; i<length; i++)
+    scratch[i] = gate[first + i];
+
+  data_t threshold = kth_largest(scratch, length, k);
+
+  // Only some channels equal to the threshold may be selected.
+  int above = 0;
+  for (int i=0; i<length; i++)
+    above += (scratch[i] > threshold);
+  int ties = k - above;
+
+  loki_free(scratch);
+
+  int count = 0;
+  for (int c=first; c<last; c++) {
+    bool tie = (gate[c] == threshold) && (ties > 0);
+    ties -= tie;
+    channels[count] = c;
+    count += (gate[c] > threshold) || tie;
+  }
+
+  return count;
+}
+
+int select_output_channels(const conv_shape_t* shape,
+                           const sparse_buffers_t* buffers,
+                           const conv_task_t* task,
+                           const test_options_t* options,
+                           int* channels) {
+  int first = task->first_out_channel;
+  int last = task->last_out_channel;
+  const data_t* gate = buffers->auxiliary->output.data.address;
+
+  switch (options->gating) {
+    case GATING_RANDOM: {
+      int count = 0;
+      for (int c=first; c<last; c++)
+        if (random_numbers[4999 - c] > options->out_sparsity)
+          channels[count++] = c;
+      return count;
+    }
+
+    case GATING_THRESHOLD:
+      return select_above(gate, first, last, options->gate_threshold, channels);
+
+    case GATING_TOP_K: {
+      // Choose from the whole layer, so the result doesn't depend on how it
+      // is shared between tiles, then keep this task's channels.
+      int total = shape->out_channels;
+      int k = (total * (100 - options->out_sparsity) + 50) / 100;
+      int* chosen = loki_malloc(total * sizeof(int));
+      assert(chosen != NULL);
+      int num_chosen = select_top_k(gate, 0, total, k, chosen);
+
+      int count = 0;
+      for (int i=0; i<num_chosen; i++)
+        if (chosen[i] >= first && chosen[i] < last)
+          channels[count++] = chosen[i];
+
+      loki_free(chosen);
+      return count;
+    }
+  }
+
+  return 0;
+}
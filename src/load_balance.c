@@ -1,178 +1,588 @@
 // Method:
 // Each tile maintains a notion of which computations it needs to perform.
-// If a tile runs out of work to do, it communicates with a neighbour.
-// The neighbour responds with a new task if it has any work left to do.
+// If a tile runs out of work to do, it asks a randomly chosen tile for more.
+// The victim responds with a new task if it has any work left to do.
 // This task can be empty if there is no spare work.
-// If an empty task is received, the tile requests work from another neighbour.
-// Once all 4 neighbours have been checked, the tile stops checking.
+// If an empty task is received, the tile tries another victim. Once every
+// other tile has been asked without success since the tile last found work,
+// there is no work left to steal, and the tile has finished.
+//
+// Splitting: the victim estimates how long its spare work and the piece it is
+// working on will take, using the cost model. The requester has nothing left
+// to do, so it should take half of the total, less the cost of moving the
+// work, for both tiles to finish together. Pieces too small to repay the move
+// are not given away.
+//
+// Termination: tiles form a binary tree, with tile 0 at the root. A tile
+// reports to its parent once it and all of its children have finished. When
+// the whole tree has finished, no requests can be in flight, so tile 0 tells
+// everyone to stop, and the message is passed down the tree. Until then,
+// tiles keep responding to requests.
+//
+// Server: optionally, core 1 of each tile answers requests, so core 0 never
+// stops computing to serve them. Both cores then share the task without locks:
+// core 0 claims output channels, and rows of its last channels, just before
+// starting them, and core 1 gives away only what hasn't been claimed. Each
+// claim or split is a single compare-and-swap, so if both happen at once, one
+// of them fails and is retried with the new values. Core 0 still handles the
+// termination messages. A new task is passed to core 1 through memory, and
+// core 0 waits until core 1 has taken it.
 
-// Request = tile_id_t of requestor.
+// Request = lb message type and tile number of sender.
 // Response = conv_task_t.
 
 #include <stdio.h>
 #include <loki/channels.h>
 #include <loki/channel_io.h>
 #include <loki/channel_map_table.h>
+#include <loki/control_registers.h>
 #include <loki/ids.h>
 #include "defs.h"
 
 #define LB_REQUEST_CHANNEL 4
 #define LB_RESPONSE_CHANNEL 5
+#define LB_SERVER_CHANNEL 4 // on core 1
 
-void init_lb_state(lb_state_t* state, int num_tiles) {
-  // Counting is a bit hacky.
-  // Requests aren't actually sent if there are few enough tiles that a tile's
-  // neighbour wraps around to itself. The request is still counted as being
-  // sent, but no request will ever be received.
+// Channel map table entry used to send load balancing messages.
+#define LB_OUTPUT 5
 
+// Messages sent to LB_REQUEST_CHANNEL.
+#define LB_MESSAGE_REQUEST 0   // Sender wants work.
+#define LB_MESSAGE_FINISHED 1  // Sender's subtree will send no more requests.
+#define LB_MESSAGE_TERMINATE 2 // All tiles have finished.
+
+// Messages between the two cores of a tile using the server.
+#define LB_MESSAGE_PUBLISH 3   // Core 1 should take shared.next_task.
+#define LB_MESSAGE_PUBLISHED 4 // Core 1 has taken it.
+#define LB_MESSAGE_STOP 5      // Core 1 should stop.
+#define LB_MESSAGE_STOPPED 6   // Core 1 has stopped.
+
+#define LB_MESSAGE(type, tile) (((type) << 16) | (tile))
+#define LB_MESSAGE_TYPE(message) ((unsigned int)(message) >> 16)
+#define LB_MESSAGE_TILE(message) ((message) & 0xffff)
+
+// Shared claim words: limit in the top half, next in the bottom half.
+#define CLAIM(limit, next) (((unsigned int)(limit) << 16) | (next))
+#define CLAIM_LIMIT(claim) ((int)((claim) >> 16))
+#define CLAIM_NEXT(claim) ((int)((claim) & 0xffff))
+#define CLAIM_MAX 0xffff // Largest channel or row number which fits.
+
+// Stress testing (see perf/stress.sh): on the host, pause for a random moment
+// in the middle of claims and splits, so that the other core runs there and
+// unlikely interleavings happen often.
+#if defined(LB_STRESS) && defined(LOKI_HOST)
+#include <unistd.h>
+#define STRESS_POINT() usleep(get_cycle_count() % 256)
+#else
+#define STRESS_POINT()
+#endif
+
+// Cost of moving a task to another tile, in convolution launches: one message
+// each way, and a cold start on the new tile.
+#define STEAL_OVERHEAD_LAUNCHES 2
+
+// Smallest piece of work worth giving away, in convolution launches.
+#define MIN_STEAL_LAUNCHES 8
+
+static const conv_task_t no_work = {0,0,0,0,0,0,false};
+
+static bool task_is_empty(const conv_task_t* task) {
+  return (task->last_in_channel <= task->first_in_channel) ||
+         (task->last_out_channel <= task->first_out_channel) ||
+         (task->last_row <= task->first_row);
+}
+
+static void start_server(lb_state_t* state);
+static void publish_task(lb_state_t* state, const conv_task_t* task);
+
+void init_lb_state(lb_state_t* state, const conv_shape_t* shape,
+                   const sparse_buffers_t* buffers, const test_options_t* options,
+                   strategy_t strategy, const conv_task_t* task) {
+  int num_tiles = options->num_tiles;
+  assert(num_tiles <= MAX_TILES);
+
+  state->num_tiles = num_tiles;
+  state->this_tile = tile2int(get_tile_id());
+  state->random = 0x9e3779b9u * (state->this_tile + 1);
+  state->finished = false;
+  state->terminated = false;
+
+  state->parent = (state->this_tile - 1) / 2;
+  state->num_children = 0;
+  for (int child=2*state->this_tile+1; child<=2*state->this_tile+2; child++)
+    if (child < num_tiles)
+      state->num_children++;
+  state->children_finished = 0;
+  state->no_spare_work = 1ull << state->this_tile;
   state->requests_made = 0;
+  state->requests_received = 0;
 
-  if (num_tiles > 4)
-    state->requests_received = 0;
-  else if (num_tiles > 1)
-    state->requests_received = 2;
-  else
-    state->requests_received = 4;
+  state->shape = shape;
+  state->buffers = buffers;
+  state->cost_model = &options->cost_model;
+  state->strategy = strategy;
+
+  state->server = options->lb_server;
+  if (state->server) {
+    start_server(state);
+    publish_task(state, task);
+  }
 }
 
 // Check whether all load balancing opportunities have been taken.
 bool lb_finished(const lb_state_t* state) {
-  return state->requests_made == 4;
+  return state->finished;
 }
 
-void empty_request_queue(lb_state_t* state);
+static void send_message(lb_state_t* state, int tile, int type) {
+  // Requests go to whichever core answers them, and messages between the
+  // cores of a tile to the other core. Everything else goes to core 0.
+  int core = COMPONENT_CORE_0;
+  if ((type == LB_MESSAGE_REQUEST && state->server) ||
+      type == LB_MESSAGE_PUBLISH || type == LB_MESSAGE_STOP)
+    core = COMPONENT_CORE_1;
 
-// Assumes a 4x4 grid of tiles, filled from top to bottom, left to right.
-conv_task_t check_neighbour(lb_state_t* state, int num_tiles) {
-  tile_id_t this_tile = get_tile_id();
-  int row = this_tile & 7;
-  int col = this_tile >> 3;
+  channel_t channel = loki_core_address(int2tile(tile), core, LB_REQUEST_CHANNEL, DEFAULT_CREDIT_COUNT);
+  set_channel_map(LB_OUTPUT, channel);
+  loki_send(LB_OUTPUT, LB_MESSAGE(type, state->this_tile));
+}
 
-  assert((num_tiles < 4) || (num_tiles % 4 == 0));
-  int max_row = num_tiles > 4 ? num_tiles / 4 : 1;
-  int max_col = num_tiles > 4 ? 4 : num_tiles;
+static void send_response(int tile, const conv_task_t* task) {
+  channel_t channel = loki_core_address(int2tile(tile), COMPONENT_CORE_0, LB_RESPONSE_CHANNEL, DEFAULT_CREDIT_COUNT);
+  set_channel_map(LB_OUTPUT, channel);
+  loki_send_data(task, sizeof(conv_task_t), LB_OUTPUT);
+}
 
-  // Order is arbitrary. Wrap around ends of the grid.
-  switch (state->requests_made) {
-    case 0: row = (row == max_row) ? 1 : row+1; break;
-    case 1: col = (col == max_col) ? 1 : col+1; break;
-    case 2: row = (row == 1) ? max_row : row-1; break;
-    case 3: col = (col == 1) ? max_col : col-1; break;
-    default:
-      printf("Error: tile %d trying to access neighbour %d (max=4)\n",
-             tile2int(this_tile), state->requests_made);
+bool request_pending() {
+  return loki_test_channel(LB_REQUEST_CHANNEL);
+}
+
+// Tell children that all tiles have finished.
+static void terminate(lb_state_t* state) {
+  state->terminated = true;
+  for (int child=2*state->this_tile+1; child<=2*state->this_tile+2; child++)
+    if (child < state->num_tiles)
+      send_message(state, child, LB_MESSAGE_TERMINATE);
+}
+
+// Once this tile and everything below it in the tree have finished, tell the
+// parent. If this is the root, everyone has finished.
+static void report_if_finished(lb_state_t* state) {
+  if (!state->finished || state->children_finished < state->num_children)
+    return;
+
+  if (state->this_tile == 0)
+    terminate(state);
+  else
+    send_message(state, state->parent, LB_MESSAGE_FINISHED);
+}
+
+// Send `spare_work` to a tile which asked for it.
+static void serve_request(lb_state_t* state, int tile, const conv_task_t* spare_work) {
+  send_response(tile, spare_work);
+  state->requests_received++;
+
+  int migrated = task_is_empty(spare_work) ? 0
+               : spare_work->last_out_channel - spare_work->first_out_channel;
+  profile_count(COUNTER_REQUESTS_SERVED, 1);
+  profile_count(COUNTER_WORK_GRANTED, migrated > 0);
+  profile_count(COUNTER_CHANNELS_MIGRATED, migrated);
+  trace_instant("LB request served", migrated);
+}
+
+// Handle one message from another tile. Requests are given work from `task`,
+// if it isn't NULL.
+static void handle_message(lb_state_t* state, int message, conv_task_t* task,
+                           const conv_task_t* current) {
+  int tile = LB_MESSAGE_TILE(message);
+
+  switch (LB_MESSAGE_TYPE(message)) {
+    case LB_MESSAGE_REQUEST: {
+      conv_task_t spare_work = no_work;
+      if (task != NULL)
+        spare_work = split_task(state, task, current);
+      serve_request(state, tile, &spare_work);
       break;
-  }
+    }
 
-  tile_id_t neighbour = tile_id(col, row);
-  conv_task_t response;
+    case LB_MESSAGE_FINISHED:
+      state->children_finished++;
+      report_if_finished(state);
+      break;
+
+    case LB_MESSAGE_TERMINATE:
+      terminate(state);
+      break;
 
-  if (neighbour == this_tile) {
-    // Don't bother sending a request, but make sure the response is empty.
-    response.first_in_channel = 0;
-    response.last_in_channel = 0;
-    response.first_out_channel = 0;
-    response.last_out_channel = 0;
+    default:
+      printf("Error: tile %d received unknown load balancing message %x\n",
+             state->this_tile, message);
+      break;
   }
-  else {
-    // Request = this tile_id_t.
-    channel_t channel = loki_core_address(neighbour, COMPONENT_CORE_0, LB_REQUEST_CHANNEL, DEFAULT_CREDIT_COUNT);
-    set_channel_map(5, channel);
-    loki_send(5, this_tile);
+}
+
+// Pick a tile which might have spare work, or return -1 if there are none.
+static int choose_victim(lb_state_t* state) {
+  int candidates = state->num_tiles - __builtin_popcountll(state->no_spare_work);
+  if (candidates == 0)
+    return -1;
 
-    // Before stalling, check to make sure no one is waiting for a response from
-    // us. There's still a small chance of a race condition here.
-    empty_request_queue(state);
+  // xorshift
+  state->random ^= state->random << 13;
+  state->random ^= state->random >> 17;
+  state->random ^= state->random << 5;
+  int choice = state->random % candidates;
 
-    // Wait for response.
-    loki_receive_data(&response, sizeof(conv_task_t), LB_RESPONSE_CHANNEL);
+  for (int tile=0; tile<state->num_tiles; tile++) {
+    if (state->no_spare_work & (1ull << tile))
+      continue;
+    if (choice-- == 0)
+      return tile;
   }
 
-  return response;
+  return -1;
 }
 
 // Request more work.
 // Store the resulting task in the given parameter, and return whether there is
 // any work to do.
 bool make_load_balance_request(conv_task_t* task, lb_state_t* state, int num_tiles) {
-  while (state->requests_made < 4) {
-    *task = check_neighbour(state, num_tiles);
+  unsigned long start = get_cycle_count();
+
+  while (!state->finished) {
+    int victim = choose_victim(state);
+
+    if (victim < 0) {
+      // Everyone has been asked, so there is no work left to steal.
+      state->finished = true;
+      report_if_finished(state);
+      break;
+    }
+
+    send_message(state, victim, LB_MESSAGE_REQUEST);
     state->requests_made++;
+    profile_count(COUNTER_REQUESTS_SENT, 1);
+    trace_instant("LB request sent", victim);
+
+    // While waiting, other tiles may be waiting for us. We have no work to
+    // give away.
+    while (!loki_test_channel(LB_RESPONSE_CHANNEL))
+      if (request_pending())
+        handle_message(state, loki_receive(LB_REQUEST_CHANNEL), NULL, NULL);
 
-    // Check whether the neighbour returned a non-zero amount of work.
-    if ((task->last_in_channel > task->first_in_channel) ||
-        (task->last_out_channel > task->first_out_channel))
+    loki_receive_data(task, sizeof(conv_task_t), LB_RESPONSE_CHANNEL);
+    trace_instant("LB response received",
+                  task_is_empty(task) ? 0 : task->last_out_channel - task->first_out_channel);
+
+    if (!task_is_empty(task)) {
+      if (state->server)
+        publish_task(state, task);
+
+      // Start a new round of requests when this work is done.
+      state->no_spare_work = 1ull << state->this_tile;
+      profile_phase(PHASE_LB_REQUEST, start);
       return true;
+    }
+
+    state->no_spare_work |= 1ull << victim;
+    profile_count(COUNTER_EMPTY_RESPONSES, 1);
   }
 
+  *task = no_work;
+  profile_phase(PHASE_LB_REQUEST, start);
   return false;
 }
 
-// All neighbours write to the same input buffer. This is generally unsafe, but
-// works here.
-//  * Buffers have size 4
-//  * Each tile has 4 neighbours, each of which will send one 1 flit request
-//  * All requests come through the local router, so are serialised
-bool request_pending() {
-  return loki_test_channel(LB_REQUEST_CHANNEL);
+static unsigned long task_cost(const lb_state_t* state, const conv_task_t* task) {
+  return predict_cycles(state->cost_model, state->strategy, state->shape,
+                        state->buffers, task);
 }
 
 // Split the given task in two. Update the given task to reduce its size, and
 // return the piece that was removed.
-conv_task_t split_task(conv_task_t* task, int in_channel_iteration,
-                       int out_channel_iteration) {
-  conv_task_t new_task;
-  new_task.first_in_channel = task->first_in_channel;
-  new_task.last_in_channel = task->last_in_channel;
-  new_task.last_out_channel = task->last_out_channel;
-
-  // Average of current position and end.
-  int split_point = (out_channel_iteration + task->last_out_channel) / 2;
-  if (split_point == out_channel_iteration)
-    split_point++;
-  new_task.first_out_channel = split_point;
-  task->last_out_channel = split_point;
+//
+// Whole output channels are given away while there are any after `current`.
+// Once the tile is on its last channels, there may still be rows of them which
+// haven't been started, so give away some of those instead. Either way, the
+// piece is the smallest which is predicted to take at least half of the
+// remaining time, after allowing for the cost of moving it.
+conv_task_t split_task(const lb_state_t* state, conv_task_t* task,
+                       const conv_task_t* current) {
+  // Partial sums are reduced by a fixed group of tiles.
+  if (task->partial_sums)
+    return no_work;
+
+  // Everything after `current` which could be given away: output channels
+  // [first, last), or if there are none, rows [first, last) of the current
+  // channels.
+  conv_task_t spare = *task;
+  bool split_rows = current->last_out_channel >= task->last_out_channel;
+  int first, last;
+
+  if (!split_rows) {
+    spare.first_out_channel = current->last_out_channel;
+    first = spare.first_out_channel;
+    last = spare.last_out_channel;
+  }
+  else if (current->last_row < task->last_row) {
+    spare.first_out_channel = current->first_out_channel;
+    spare.first_row = current->last_row;
+    first = spare.first_row;
+    last = spare.last_row;
+  }
+  else
+    return no_work;
+
+  unsigned long spare_cycles = task_cost(state, &spare);
+  unsigned long current_cycles = task_cost(state, current);
+  unsigned long overhead = STEAL_OVERHEAD_LAUNCHES * state->cost_model->launch;
+  if (spare_cycles + current_cycles <= overhead)
+    return no_work;
+
+  // Both tiles finish together if the requester takes half of the work left,
+  // less the time it needs to receive it.
+  unsigned long target = (spare_cycles + current_cycles - overhead) / 2;
+  if (target > spare_cycles)
+    target = spare_cycles;
+  if (target < MIN_STEAL_LAUNCHES * state->cost_model->launch)
+    return no_work;
+
+  // Find the largest split point which gives away at least `target`. The
+  // cost of [split, last) only falls as split increases.
+  conv_task_t new_task = spare;
+  int low = first, high = last - 1;
+  while (low < high) {
+    int split = (low + high + 1) / 2;
+    if (split_rows)
+      new_task.first_row = split;
+    else
+      new_task.first_out_channel = split;
+
+    if (task_cost(state, &new_task) >= target)
+      low = split;
+    else
+      high = split - 1;
+  }
+
+  // The current channels keep their rows up to the split point.
+  if (split_rows) {
+    new_task.first_row = low;
+    task->last_row = low;
+  }
+  else {
+    new_task.first_out_channel = low;
+    task->last_out_channel = low;
+  }
 
   return new_task;
 }
 
-// Iterations are counted within the current task only.
-// TODO: don't really want to pass current iteration counts.
 void check_load_balance_requests(conv_task_t* task, lb_state_t* state,
-                                 int in_channel_iteration, int out_channel_iteration) {
-  while (request_pending()) {
-    tile_id_t tile = loki_receive(LB_REQUEST_CHANNEL);
-    channel_t channel = loki_core_address(tile, COMPONENT_CORE_0, LB_RESPONSE_CHANNEL, DEFAULT_CREDIT_COUNT);
-    set_channel_map(5, channel);
-
-    conv_task_t spare_work = split_task(task, in_channel_iteration, out_channel_iteration);
-    loki_send_data(&spare_work, sizeof(conv_task_t), 5);
-    state->requests_received++;
+                                 const conv_task_t* current) {
+  while (request_pending())
+    handle_message(state, loki_receive(LB_REQUEST_CHANNEL), task, current);
+}
+
+// Wait until all other tiles have finished. We may need to respond to their
+// requests.
+void lb_sync(lb_state_t* state) {
+  unsigned long start = get_cycle_count();
+
+  while (!state->terminated)
+    handle_message(state, loki_receive(LB_REQUEST_CHANNEL), NULL, NULL);
+
+  // No tile can send any more requests, so the server can stop.
+  if (state->server) {
+    send_message(state, state->this_tile, LB_MESSAGE_STOP);
+    while (LB_MESSAGE_TYPE(loki_receive(LB_REQUEST_CHANNEL)) != LB_MESSAGE_STOPPED)
+      ;
   }
+
+  profile_phase(PHASE_LB_SYNC, start);
 }
 
-void empty_request_queue(lb_state_t* state) {
-  while (request_pending()) {
-    tile_id_t tile = loki_receive(LB_REQUEST_CHANNEL);
-    channel_t channel = loki_core_address(tile, COMPONENT_CORE_0, LB_RESPONSE_CHANNEL, DEFAULT_CREDIT_COUNT);
-    set_channel_map(5, channel);
 
-    conv_task_t spare_work = {0,0,0,0};
-    loki_send_data(&spare_work, sizeof(conv_task_t), 5);
-    state->requests_received++;
+// Server.
+
+// Give away spare work from the task shared with core 0, using split_task on
+// a snapshot of it. The split only takes effect if nothing has been claimed
+// since the snapshot; otherwise, try again.
+static conv_task_t split_shared_task(lb_state_t* state) {
+  lb_shared_t* shared = &state->shared;
+
+  while (true) {
+    unsigned int channels = __atomic_load_n(&shared->channels, __ATOMIC_SEQ_CST);
+    conv_task_t task = shared->task;
+    task.last_out_channel = CLAIM_LIMIT(channels);
+
+    // Core 0 is working on the group of channels which ends at the next
+    // unclaimed channel. Its progress through them is unknown.
+    conv_task_t current = task;
+    current.first_out_channel = current.last_out_channel = CLAIM_NEXT(channels);
+    bool split_rows = current.last_out_channel >= task.last_out_channel;
+
+    // Once all channels have been claimed, rows of the last group can be
+    // given away. Core 0 sets `group_first` before `rows` when it starts a
+    // group, so `rows` is read first: if it belongs to the new group, so does
+    // `group_first`. If the group's rows change while reading, start again.
+    unsigned int rows = 0;
+    if (split_rows) {
+      rows = __atomic_load_n(&shared->rows, __ATOMIC_SEQ_CST);
+      if (CLAIM_NEXT(rows) >= CLAIM_LIMIT(rows))
+        return no_work;
+    }
+    STRESS_POINT();
+
+    int group_first = __atomic_load_n(&shared->group_first, __ATOMIC_SEQ_CST);
+    if (split_rows && __atomic_load_n(&shared->rows, __ATOMIC_SEQ_CST) != rows)
+      continue;
+    if (group_first >= task.first_out_channel && group_first < current.last_out_channel)
+      current.first_out_channel = group_first;
+    else if (split_rows)
+      return no_work;
+
+    if (split_rows) {
+      current.first_row = current.last_row = CLAIM_NEXT(rows);
+      task.last_row = CLAIM_LIMIT(rows);
+    }
+
+    conv_task_t spare_work = split_task(state, &task, &current);
+    if (task_is_empty(&spare_work))
+      return no_work;
+    STRESS_POINT();
+
+    bool split;
+    if (split_rows)
+      split = __atomic_compare_exchange_n(&shared->rows, &rows,
+          CLAIM(task.last_row, CLAIM_NEXT(rows)), false,
+          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    else
+      split = __atomic_compare_exchange_n(&shared->channels, &channels,
+          CLAIM(task.last_out_channel, CLAIM_NEXT(channels)), false,
+          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+    if (split)
+      return spare_work;
   }
 }
 
-// Wait until all neighbours have finished. We may need to respond to their
-// requests.
-void lb_sync(lb_state_t* state) {
-  while (state->requests_received < 4) {
-    tile_id_t tile = loki_receive(LB_REQUEST_CHANNEL);
-    channel_t channel = loki_core_address(tile, COMPONENT_CORE_0, LB_RESPONSE_CHANNEL, DEFAULT_CREDIT_COUNT);
-    set_channel_map(5, channel);
-
-    conv_task_t spare_work = {0,0,0,0};
-    loki_send_data(&spare_work, sizeof(conv_task_t), 5);
-    state->requests_received++;
+// Function executed by core 1 of every tile using the server.
+static void lb_server(const void* data) {
+  lb_state_t* state = *(lb_state_t* const*)data;
+  lb_shared_t* shared = &state->shared;
+
+  while (true) {
+    int message = loki_receive(LB_SERVER_CHANNEL);
+
+    switch (LB_MESSAGE_TYPE(message)) {
+      case LB_MESSAGE_REQUEST: {
+        conv_task_t spare_work = split_shared_task(state);
+        serve_request(state, LB_MESSAGE_TILE(message), &spare_work);
+        break;
+      }
+
+      case LB_MESSAGE_PUBLISH:
+        // Core 0 is waiting, so can't claim anything yet. Rows are set up as
+        // each group of channels is claimed.
+        shared->task = shared->next_task;
+        assert(shared->task.last_out_channel <= CLAIM_MAX &&
+               shared->task.last_row <= CLAIM_MAX);
+        __atomic_store_n(&shared->rows, 0, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&shared->channels,
+                         CLAIM(shared->task.last_out_channel,
+                               shared->task.first_out_channel), __ATOMIC_SEQ_CST);
+        send_message(state, state->this_tile, LB_MESSAGE_PUBLISHED);
+        break;
+
+      case LB_MESSAGE_STOP:
+        flush_trace();
+        send_message(state, state->this_tile, LB_MESSAGE_STOPPED);
+        return;
+
+      default:
+        printf("Error: tile %d server received unknown load balancing message %x\n",
+               state->this_tile, message);
+        break;
+    }
+  }
+}
+
+static void start_server(lb_state_t* state) {
+  // Nothing can be claimed until a task is published.
+  state->shared.channels = 0;
+  state->shared.rows = 0;
+  state->shared.group_first = 0;
+
+  lb_state_t* pointer = state;
+  loki_remote_execute(get_tile_id(), 1, &lb_server, &pointer, sizeof(pointer));
+}
+
+// Hand a new task to core 1, and wait until it has been taken. Termination
+// messages may arrive in the meantime.
+static void publish_task(lb_state_t* state, const conv_task_t* task) {
+  state->shared.next_task = *task;
+  state->claimed_out = task->first_out_channel;
+  send_message(state, state->this_tile, LB_MESSAGE_PUBLISH);
+
+  while (true) {
+    int message = loki_receive(LB_REQUEST_CHANNEL);
+    if (LB_MESSAGE_TYPE(message) == LB_MESSAGE_PUBLISHED)
+      break;
+    handle_message(state, message, NULL, NULL);
   }
 }
+
+bool claim_work(lb_state_t* state, conv_task_t* task, conv_task_t* current) {
+  if (!state->server)
+    return true;
+
+  lb_shared_t* shared = &state->shared;
+
+  // A new group of output channels.
+  if (current->first_out_channel >= state->claimed_out) {
+    unsigned int channels = __atomic_load_n(&shared->channels, __ATOMIC_SEQ_CST);
+    int end;
+    do {
+      task->last_out_channel = CLAIM_LIMIT(channels);
+      if (CLAIM_NEXT(channels) >= task->last_out_channel) {
+        current->last_out_channel = current->first_out_channel;
+        return false;
+      }
+      end = current->last_out_channel;
+      if (end > task->last_out_channel)
+        end = task->last_out_channel;
+    } while (!__atomic_compare_exchange_n(&shared->channels, &channels,
+                 CLAIM(task->last_out_channel, end), false,
+                 __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    current->last_out_channel = end;
+    state->claimed_out = end;
+    STRESS_POINT();
+
+    // The rows of the previous group have all been claimed, so core 1 won't
+    // touch them while they are replaced. `group_first` must be set first:
+    // core 1 relies on the order (see split_shared_task).
+    __atomic_store_n(&shared->group_first, current->first_out_channel, __ATOMIC_SEQ_CST);
+    STRESS_POINT();
+    __atomic_store_n(&shared->rows, CLAIM(task->last_row, task->first_row), __ATOMIC_SEQ_CST);
+  }
+
+  // The next band of rows of this group.
+  unsigned int rows = __atomic_load_n(&shared->rows, __ATOMIC_SEQ_CST);
+  int end;
+  do {
+    task->last_row = CLAIM_LIMIT(rows);
+    if (CLAIM_NEXT(rows) >= task->last_row) {
+      current->last_row = current->first_row;
+      return false;
+    }
+    end = current->last_row;
+    if (end > task->last_row)
+      end = task->last_row;
+  } while (!__atomic_compare_exchange_n(&shared->rows, &rows,
+               CLAIM(task->last_row, end), false,
+               __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+  current->last_row = end;
+  return true;
+}
@@ -1,8 +1,8 @@
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <loki/channels.h>
+#include <loki/ids.h>
 #include <loki/spawn.h>
 #include <nn/layers.h>
 #include "defs.h"
@@ -13,72 +13,163 @@ typedef struct {
   test_fn* test;
   void* buffers;
 
-  int in_sparsity;
-  int out_sparsity;
+  test_options_t options;
 
-  int num_tiles;
+  // Whether events are being traced.
+  bool tracing;
+
+  // When tile 0 began starting the tiles.
+  unsigned long launch_start;
 } test_config;
 
-// Function executed by core 0 of every active tile.
+// Options which control how a test is run, rather than what it computes.
+typedef struct {
+  const char* loop_nest_file;
+  bool tune;
+  int repeats;
+  int warmup;
+  bool profile;
+  const char* trace_file; // NULL if not tracing.
+  bool checksum;
+  bool reference; // Also print the checksum of a naive convolution.
+} run_config;
+
+// Function executed by core 0 of every active tile. Each tile first starts
+// its children in the broadcast tree, so that all tiles are started in
+// ceil(log2(tiles)) steps.
 static void tile_task(const void* data) {
   const test_config* config = (const test_config*)data;
+  int tile = tile2int(get_tile_id());
 
-  config->test(
-    &config->shape,
-    config->buffers,
-    config->in_sparsity,
-    config->out_sparsity,
-    config->num_tiles
-  );
+  for (int step=tree_first_step(tile); tile+step<config->options.num_tiles; step*=2)
+    loki_remote_execute(int2tile(tile + step), 0, &tile_task, config,
+                        sizeof(test_config));
 
-  loki_sync_tiles(config->num_tiles);
-}
+  unsigned long start = profile_phase(PHASE_STARTUP, config->launch_start);
+  config->test(&config->shape, config->buffers, &config->options);
+  profile_phase(PHASE_TOTAL, start);
+  flush_profile();
 
-int main(int argc, char** argv) {
-  if (argc < 7) {
-    printf(""
-    "Usage: lat-dynamic in-channels in-size in-sparsity out-channels\\ \n"
-    "                   out-sparsity filter-size [--mode=mode] [--tiles=N]\n"
-    "'size' parameters indicate the width/height in pixels\n"
-    "'sparsity' parameters are percentages\n"
-    "'mode' selects how to exploit sparsity ('none', 'simple', 'adaptive')\n");
-    exit(1);
+  start = get_cycle_count();
+  loki_sync_tiles(config->options.num_tiles);
+  trace_complete("loki_sync_tiles", start, 0);
+
+  // The trace includes the synchronisation above, so needs another one to be
+  // sure that everything has been flushed before tile 0 reads it.
+  if (config->tracing) {
+    flush_trace();
+    loki_sync_tiles(config->options.num_tiles);
   }
+}
 
-  // TODO: do all memory allocation out here, and pass dense tensors to other
-  // tiles.
-  test_config config;
-  config.shape.in_channels = atoi(argv[1]);
-  config.shape.image_width = atoi(argv[2]);
-  config.shape.image_height = config.shape.image_width;
-  config.in_sparsity = atoi(argv[3]);
-  config.shape.out_channels = atoi(argv[4]);
-  config.out_sparsity = atoi(argv[5]);
-  config.shape.filter_width = atoi(argv[6]);
-  config.shape.filter_height = config.shape.filter_width;
-  config.shape.batch_size = 1;
-  config.shape.groups = 1;
-  config.shape.stride = 1;
-  config.shape.dilation = 1;
-
-  config.test = test_simple;
-  config.num_tiles = 1;
+static void usage(void) {
+  printf(""
+  "Usage: lat-dynamic in-channels in-size in-sparsity out-channels\\ \n"
+  "                   out-sparsity filter-size [--mode=mode] [--tiles=N]\\ \n"
+  "                   [--gating=gating] [--threshold=T] [--async=0|1]\\ \n"
+  "                   [--lb-server=0|1]\\ \n"
+  "                   [--weight-block=B] [--cost-model=C]\\ \n"
+  "                   [--dense-threshold=D] [--partition=P] [--tune=0|1]\\ \n"
+  "                   [--loop-nests=file] [--repeats=N] [--warmup=N]\\ \n"
+  "                   [--profile=0|1] [--trace=file] [--checksum=0|1]\\ \n"
+  "                   [--reference=0|1]\n"
+  "       lat-dynamic --sweep=grid [--csv=file] [options]\n"
+  "       lat-dynamic --calibrate\n"
+  "'size' parameters indicate the width/height in pixels\n"
+  "'sparsity' parameters are percentages\n"
+  "'mode' selects how to exploit sparsity ('none', 'simple', 'adaptive',\n"
+  "    'gather', 'hybrid', 'auto')\n"
+  "'tiles' is the number of tiles to share the work between (default 1)\n"
+  "'gating' selects how output channels are chosen ('random', 'threshold',\n"
+  "    'topk'). 'threshold' uses T (default 0).\n"
+  "'async' selects whether core 1 issues convolutions (default 1)\n"
+  "'lb-server' makes core 1 answer load balancing requests instead, so that\n"
+  "    core 0 never stops to serve other tiles. Implies --async=0 (default 0)\n"
+  "'weight-block' stores weights in BxB channel blocks (default 0: unblocked)\n"
+  "'cost-model' sets the constants used by 'auto' mode, as printed by\n"
+  "    --calibrate\n"
+  "'dense-threshold' is the percentage of a block's channel pairs which must\n"
+  "    be computed for 'hybrid' mode to treat it as dense (default 50)\n"
+  "'partition' selects how the sparse modes first share work between tiles\n"
+  "    ('out', 'in', '2d', 'auto'; default 'auto')\n"
+  "'loop-nests' is a cache of tuned loop orders (default " DEFAULT_LOOP_NEST_FILE ")\n"
+  "'tune' finds loop orders for any convolution shapes missing from the cache\n"
+  "    after the computation, and adds them (default 0)\n"
+  "'repeats' times the computation N times (default 1), after 'warmup'\n"
+  "    untimed runs (default 0)\n"
+  "'profile' prints the time each tile spent in each phase of the last run,\n"
+  "    and its load balancing activity (default 0)\n"
+  "'trace' writes a timeline of the last run to a file, in Chrome's trace\n"
+  "    event format\n"
+  "'checksum' fills the inputs and weights with known values, and prints a\n"
+  "    checksum of the computed outputs (default 0)\n"
+  "'reference' also prints the checksum of the same outputs computed by a\n"
+  "    naive convolution, which should match. Implies --checksum=1\n"
+  "    (default 0)\n"
+  "'sweep' runs every combination of the parameters listed in a grid file,\n"
+  "    and writes the median, minimum and maximum time of each as CSV\n");
+  exit(1);
+}
+
+static void parse_arguments(int argc, char** argv, test_config* config,
+                            run_config* run) {
+  if (argc < 7)
+    usage();
+
+  config->shape.in_channels = atoi(argv[1]);
+  config->shape.image_width = atoi(argv[2]);
+  config->shape.image_height = config->shape.image_width;
+  config->options.in_sparsity = atoi(argv[3]);
+  config->shape.out_channels = atoi(argv[4]);
+  config->options.out_sparsity = atoi(argv[5]);
+  config->shape.filter_width = atoi(argv[6]);
+  config->shape.filter_height = config->shape.filter_width;
+  config->shape.batch_size = 1;
+  config->shape.groups = 1;
+  config->shape.stride = 1;
+  config->shape.dilation = 1;
+
+  config->test = test_simple;
+  config->options.gating = GATING_RANDOM;
+  config->options.gate_threshold = 0;
+  config->options.async_conv = true;
+  config->options.lb_server = false;
+  config->options.weight_block_size = 0;
+  config->options.cost_model = DEFAULT_COST_MODEL;
+  config->options.dense_threshold = 50;
+  config->options.partition = PARTITION_AUTO;
+
+  run->loop_nest_file = DEFAULT_LOOP_NEST_FILE;
+  run->tune = false;
+  run->repeats = 1;
+  run->warmup = 0;
+  run->profile = false;
+  run->trace_file = NULL;
+  run->checksum = false;
+  run->reference = false;
+  config->options.num_tiles = 1;
 
   for (int i=7; i<argc; i++) {
     if (!strncmp(argv[i], "--mode=", 7)) {
       char* mode = argv[i] + 7;
 
       if (!strcmp(mode, "none")) {
-        config.test = test_none;
-        config.buffers = init_dense_buffers(&config.shape);
+        config->test = test_none;
       }
       else if (!strcmp(mode, "simple")) {
-        config.test = test_simple;
-        config.buffers = init_sparse_buffers(&config.shape, config.in_sparsity);
+        config->test = test_simple;
       }
       else if (!strcmp(mode, "adaptive")) {
-        config.test = test_adaptive;
-        config.buffers = init_sparse_buffers(&config.shape, config.in_sparsity);
+        config->test = test_adaptive;
+      }
+      else if (!strcmp(mode, "gather")) {
+        config->test = test_gather;
+      }
+      else if (!strcmp(mode, "hybrid")) {
+        config->test = test_hybrid;
+      }
+      else if (!strcmp(mode, "auto")) {
+        config->test = test_auto;
       }
       else {
         printf("Error: unknown mode parameter: '%s'\n", mode);
@@ -87,7 +178,102 @@ int main(int argc, char** argv) {
     }
     else if (!strncmp(argv[i], "--tiles=", 8)) {
       char* tiles = argv[i] + 8;
-      config.num_tiles = atoi(tiles);
+      config->options.num_tiles = atoi(tiles);
+      if (config->options.num_tiles < 1 || config->options.num_tiles > MAX_TILES) {
+        printf("Error: tiles must be between 1 and %d\n", MAX_TILES);
+        exit(1);
+      }
+    }
+    else if (!strncmp(argv[i], "--gating=", 9)) {
+      char* gating = argv[i] + 9;
+
+      if (!strcmp(gating, "random"))
+        config->options.gating = GATING_RANDOM;
+      else if (!strcmp(gating, "threshold"))
+        config->options.gating = GATING_THRESHOLD;
+      else if (!strcmp(gating, "topk"))
+        config->options.gating = GATING_TOP_K;
+      else {
+        printf("Error: unknown gating parameter: '%s'\n", gating);
+        exit(1);
+      }
+    }
+    else if (!strncmp(argv[i], "--threshold=", 12)) {
+      char* threshold = argv[i] + 12;
+      config->options.gate_threshold = atoi(threshold);
+    }
+    else if (!strncmp(argv[i], "--async=", 8)) {
+      char* async = argv[i] + 8;
+      config->options.async_conv = atoi(async);
+    }
+    else if (!strncmp(argv[i], "--lb-server=", 12)) {
+      char* enable = argv[i] + 12;
+      config->options.lb_server = atoi(enable);
+    }
+    else if (!strncmp(argv[i], "--weight-block=", 15)) {
+      char* block = argv[i] + 15;
+      config->options.weight_block_size = atoi(block);
+    }
+    else if (!strncmp(argv[i], "--dense-threshold=", 18)) {
+      char* threshold = argv[i] + 18;
+      config->options.dense_threshold = atoi(threshold);
+    }
+    else if (!strncmp(argv[i], "--partition=", 12)) {
+      char* partition = argv[i] + 12;
+
+      if (!strcmp(partition, "auto"))
+        config->options.partition = PARTITION_AUTO;
+      else if (!strcmp(partition, "out"))
+        config->options.partition = PARTITION_OUTPUT;
+      else if (!strcmp(partition, "in"))
+        config->options.partition = PARTITION_INPUT;
+      else if (!strcmp(partition, "2d"))
+        config->options.partition = PARTITION_2D;
+      else {
+        printf("Error: unknown partition parameter: '%s'\n", partition);
+        exit(1);
+      }
+    }
+    else if (!strncmp(argv[i], "--tune=", 7)) {
+      char* enable = argv[i] + 7;
+      run->tune = atoi(enable);
+    }
+    else if (!strncmp(argv[i], "--loop-nests=", 13)) {
+      run->loop_nest_file = argv[i] + 13;
+    }
+    else if (!strncmp(argv[i], "--repeats=", 10)) {
+      char* repeats = argv[i] + 10;
+      run->repeats = atoi(repeats);
+      if (run->repeats < 1 || run->repeats > MAX_REPEATS) {
+        printf("Error: repeats must be between 1 and %d\n", MAX_REPEATS);
+        exit(1);
+      }
+    }
+    else if (!strncmp(argv[i], "--warmup=", 9)) {
+      char* warmup = argv[i] + 9;
+      run->warmup = atoi(warmup);
+    }
+    else if (!strncmp(argv[i], "--profile=", 10)) {
+      char* enable = argv[i] + 10;
+      run->profile = atoi(enable);
+    }
+    else if (!strncmp(argv[i], "--trace=", 8)) {
+      run->trace_file = argv[i] + 8;
+    }
+    else if (!strncmp(argv[i], "--checksum=", 11)) {
+      char* enable = argv[i] + 11;
+      run->checksum = atoi(enable);
+    }
+    else if (!strncmp(argv[i], "--reference=", 12)) {
+      char* enable = argv[i] + 12;
+      run->reference = atoi(enable);
+    }
+    else if (!strncmp(argv[i], "--cost-model=", 13)) {
+      char* model = argv[i] + 13;
+      if (!parse_cost_model(model, &config->options.cost_model)) {
+        printf("Error: cost model should be four comma-separated integers: '%s'\n", model);
+        exit(1);
+      }
     }
     else {
       printf("Unknown argument: %s\n", argv[i]);
@@ -95,33 +281,141 @@ int main(int argc, char** argv) {
     }
   }
 
-  // Distribution of work across tiles is very simple at the moment.
-  assert(config.shape.in_channels % config.num_tiles == 0);
-  assert(config.shape.out_channels % config.num_tiles == 0);
+  // Core 1 can't issue convolutions while it is serving requests.
+  if (config->options.lb_server)
+    config->options.async_conv = false;
+
+  // The reference is computed from the known values.
+  if (run->reference)
+    run->checksum = true;
+}
+
+int run_test(int argc, char** argv, unsigned long* durations) {
+  // TODO: do all memory allocation out here, and pass dense tensors to other
+  // tiles.
+  test_config config;
+  run_config run;
+  parse_arguments(argc, argv, &config, &run);
+
+  reset_fn* reset;
+  fill_fn* fill;
+  checksum_fn* checksum;
+  checksum_fn* reference;
+  if (config.test == test_none) {
+    config.buffers = init_dense_buffers(&config.shape);
+    reset = reset_dense_buffers;
+    fill = fill_dense_buffers;
+    checksum = checksum_dense_buffers;
+    reference = reference_checksum_dense_buffers;
+  }
+  else {
+    config.buffers = init_sparse_buffers(&config.shape, &config.options);
+    reset = reset_sparse_buffers;
+    fill = fill_sparse_buffers;
+    checksum = checksum_sparse_buffers;
+    reference = reference_checksum_sparse_buffers;
+  }
+
+  if (run.checksum)
+    fill(config.buffers, &config.shape);
+
+  load_loop_nests(run.loop_nest_file);
+  if (run.tune)
+    record_untuned_shapes(config.options.num_tiles);
+  if (run.profile)
+    init_profiles(config.options.num_tiles);
+  config.tracing = (run.trace_file != NULL);
+  if (config.tracing)
+    init_trace(config.options.num_tiles);
 
   // Can't use libloki initialisation because that assumes 8 cores per tile.
-  init(config.num_tiles);
+  unsigned long setup_start = get_cycle_count();
+  init(config.options.num_tiles);
+  if (run.profile)
+    printf("Tile setup took %lu cycles\n", get_cycle_count() - setup_start);
 
-  // Flush function arguments so remote tiles can access them.
-  loki_channel_flush_data(1, &config, sizeof(test_config));
+  int count = 0;
+  for (int iteration = 0; iteration < run.warmup + run.repeats; iteration++) {
+    if (iteration > 0) {
+      reset(config.buffers, &config.shape);
+      reset_profiles();
+      reset_trace();
+    }
 
-  // Start timer.
-  unsigned long start = get_cycle_count();
+    // Start timer.
+    unsigned long start = get_cycle_count();
 
-  // Main computation.
-  for (int tile = config.num_tiles-1; tile >= 0; tile--) {
-    loki_remote_execute(int2tile(tile), 0, &tile_task, &config,
-                        sizeof(test_config));
+    // Main computation. Tile 0 starts the others.
+    config.launch_start = start;
+    loki_channel_flush_data(1, &config, sizeof(test_config));
+    loki_remote_execute(int2tile(0), 0, &tile_task, &config, sizeof(test_config));
+
+    // Stop timer.
+    unsigned long duration = get_cycle_count() - start;
+
+    if (iteration >= run.warmup) {
+      printf("Computation took %lu cycles\n", duration);
+      durations[count++] = duration;
+    }
+  }
+
+  if (run.checksum)
+    printf("Output checksum %08x\n", checksum(config.buffers, &config.shape));
+  if (run.reference)
+    printf("Reference checksum %08x\n", reference(config.buffers, &config.shape));
+
+  if (run.profile) {
+    print_profiles();
+    delete_profiles();
   }
 
-  // Stop timer.
-  unsigned long duration = get_cycle_count() - start;
-  printf("Computation took %lu cycles\n", duration);
+  if (config.tracing) {
+    write_trace(run.trace_file);
+    delete_trace();
+  }
+
+  if (run.tune)
+    tune_loop_nests(run.loop_nest_file);
 
   if (config.test == test_none)
     delete_dense_buffers(config.buffers);
   else
     delete_sparse_buffers(config.buffers);
 
+  return count;
+}
+
+int main(int argc, char** argv) {
+  if (argc == 2 && !strcmp(argv[1], "--calibrate")) {
+    cost_model_t model;
+    calibrate_cost_model(&model);
+    print_cost_model(&model);
+    return 0;
+  }
+
+  if (argc >= 2 && !strncmp(argv[1], "--sweep=", 8)) {
+    const char* grid_file = argv[1] + 8;
+    const char* csv_file = NULL;
+    int first_extra = 2;
+
+    if (argc >= 3 && !strncmp(argv[2], "--csv=", 6)) {
+      csv_file = argv[2] + 6;
+      first_extra = 3;
+    }
+
+    run_sweep(grid_file, csv_file, argc - first_extra, argv + first_extra);
+    return 0;
+  }
+
+  unsigned long durations[MAX_REPEATS];
+  int count = run_test(argc, argv, durations);
+
+  if (count > 1) {
+    unsigned long median, min, max;
+    summarise_durations(durations, count, &median, &min, &max);
+    printf("Median %lu, min %lu, max %lu cycles over %d runs\n",
+           median, min, max, count);
+  }
+
   return 0;
 }
@@ -1,24 +1,39 @@
 // Functions mostly taken from libloki, but adapted for the different hardware
 // configuration when using accelerators.
 
-#include <loki/alloc.h>
 #include <loki/channel_map_table.h>
+#include <loki/ids.h>
 #include <loki/init.h>
+#include <loki/spawn.h>
+#include "defs.h"
 
 #define CORES_PER_ACCELERATOR_TILE 2
 
-// Only initialise core 0 on each tile for now.
-void init_tile(const tile_id_t tile, const init_config* config) {
+#ifdef LOKI_HOST
+
+// The host backend has no boot sequence: each core is a thread.
+void init_core(const tile_id_t tile, int core, const init_config* config) {
+  loki_host_start_core(tile, core);
+}
+
+// Only the stack size is used on the host, so any address will do.
+static char* get_stack_pointer(void) {
+  return NULL;
+}
+
+#else
+
+void init_core(const tile_id_t tile, int core, const init_config* config) {
 
   // Send initial configuration.
-  int data_input = loki_core_address(tile, 0, 3, INFINITE_CREDIT_COUNT);
+  int data_input = loki_core_address(tile, core, 3, INFINITE_CREDIT_COUNT);
   set_channel_map(2, data_input);
   loki_send(2, config->inst_mem);
   loki_send(2, config->data_mem);
-  loki_send(2, (int)config->stack_pointer - tile2int(tile)*CORES_PER_ACCELERATOR_TILE*config->stack_size);
+  loki_send(2, (int)config->stack_pointer - (tile2int(tile)*CORES_PER_ACCELERATOR_TILE + core)*config->stack_size);
 
   // Send some instructions to execute.
-  int inst_fifo = loki_core_address(tile, 0, 0, INFINITE_CREDIT_COUNT);
+  int inst_fifo = loki_core_address(tile, core, 0, INFINITE_CREDIT_COUNT);
   set_channel_map(2, inst_fifo);
 
   asm volatile (
@@ -38,28 +53,65 @@ void init_tile(const tile_id_t tile, const init_config* config) {
 
 }
 
-void init(int num_tiles) {
-  if (num_tiles <= 1)
-    return;
-
-  init_config *config = loki_malloc(sizeof(init_config));
-  config->cores = num_tiles * CORES_PER_ACCELERATOR_TILE;
-  config->stack_size = 0x12000;
-  config->inst_mem = get_channel_map(0);
-  config->data_mem = get_channel_map(1);
-  config->config_func = NULL;
-
+static char* get_stack_pointer(void) {
   char *stack_pointer; // Core 0's default stack pointer
   asm ("addu %0, r8, r0\nfetchr.eop 0f\n0:\n" : "=r"(stack_pointer) : : );
   stack_pointer += 0x400 - ((int)stack_pointer & 0x3ff); // Guess at the initial sp
-  config->stack_pointer = stack_pointer;
+  return stack_pointer;
+}
+
+#endif // LOKI_HOST
 
-  loki_channel_flush_data(1, config, sizeof(init_config));
-  for (unsigned int tile = 1; tile < num_tiles; tile++) {
-    init_tile(int2tile(tile), config);
+// Number of tiles whose cores have already been set up.
+static int tiles_initialised = 0;
+
+typedef struct {
+  init_config config;
+  int num_tiles;
+  int first_new_tile; // Tiles below this are already set up.
+} setup_t;
+
+// Set up the cores of this tile's subtree of the broadcast tree. Each child's
+// core 0 is set up first, and then sets up its own subtree, so that tiles are
+// set up in parallel. Tiles which are already set up still pass the work on.
+static void setup_subtree(const void* data) {
+  const setup_t* setup = (const setup_t*)data;
+  int tile = tile2int(get_tile_id());
+
+  for (int step=tree_first_step(tile); tile+step<setup->num_tiles; step*=2) {
+    int child = tile + step;
+    if (child >= setup->first_new_tile)
+      init_core(int2tile(child), 0, &setup->config);
+    loki_remote_execute(int2tile(child), 0, &setup_subtree, setup, sizeof(setup_t));
   }
 
-  // init local tile here if needed
+  if (tile >= setup->first_new_tile)
+    init_core(get_tile_id(), 1, &setup->config);
+
+  // The cores may not be used until every tile has finished.
+  loki_sync_tiles(setup->num_tiles);
+}
+
+// Core 0 of each tile runs the main computation. Core 1 is used to issue
+// asynchronous convolutions (see accelerator.c), or to answer load balancing
+// requests (see load_balance.c).
+// May be called again to add more tiles: cores already set up are left alone.
+void init(int num_tiles) {
+  if (num_tiles <= tiles_initialised)
+    return;
+
+  setup_t setup;
+  setup.config.cores = num_tiles * CORES_PER_ACCELERATOR_TILE;
+  setup.config.stack_size = 0x12000;
+  setup.config.inst_mem = get_channel_map(0);
+  setup.config.data_mem = get_channel_map(1);
+  setup.config.config_func = NULL;
+  setup.config.stack_pointer = get_stack_pointer();
+  setup.num_tiles = num_tiles;
+  setup.first_new_tile = tiles_initialised;
+
+  // Core 0 of tile 0 is already running this code, so is never set up.
+  setup_subtree(&setup);
 
-  loki_free(config);
+  tiles_initialised = num_tiles;
 }
@@ -0,0 +1,97 @@
+// Per-tile profiling.
+//
+// Each tile adds to its own entry of a shared array, so recording needs no
+// communication. Tiles flush their entries once they finish, and tile 0
+// prints them all after the final synchronisation. get_cycle_count() is only
+// called at phase boundaries, so the overhead is a few instructions per
+// phase.
+
+#include <stdio.h>
+#include <string.h>
+#include <loki/alloc.h>
+#include <loki/channels.h>
+#include <loki/control_registers.h>
+#include <loki/ids.h>
+#include "defs.h"
+
+typedef struct {
+  unsigned long cycles[NUM_PHASES];
+  unsigned long counts[NUM_COUNTERS];
+} profile_t;
+
+// One per tile, or NULL if profiling is disabled.
+static profile_t* profiles = NULL;
+static int profile_tiles = 0;
+
+// Names used when phases are traced.
+static const char* phase_names[NUM_PHASES] = {
+  "Startup", "Downsample", "Auxiliary", "Gating", "Conv", "LB request", "LB sync",
+  "Reduce", "Total"
+};
+
+void init_profiles(int num_tiles) {
+  profiles = loki_malloc(num_tiles * sizeof(profile_t));
+  assert(profiles != NULL);
+  profile_tiles = num_tiles;
+  reset_profiles();
+}
+
+void delete_profiles(void) {
+  loki_free(profiles);
+  profiles = NULL;
+  profile_tiles = 0;
+}
+
+void reset_profiles(void) {
+  if (profiles == NULL)
+    return;
+
+  memset(profiles, 0, profile_tiles * sizeof(profile_t));
+  loki_channel_flush_data(1, profiles, profile_tiles * sizeof(profile_t));
+}
+
+unsigned long profile_phase(phase_t phase, unsigned long start) {
+  unsigned long now = trace_complete(phase_names[phase], start, 0);
+  if (profiles != NULL)
+    profiles[tile2int(get_tile_id())].cycles[phase] += now - start;
+  return now;
+}
+
+void profile_count(counter_t counter, int amount) {
+  if (profiles != NULL)
+    profiles[tile2int(get_tile_id())].counts[counter] += amount;
+}
+
+void flush_profile(void) {
+  if (profiles != NULL)
+    loki_channel_flush_data(1, &profiles[tile2int(get_tile_id())],
+                            sizeof(profile_t));
+}
+
+void print_profiles(void) {
+  if (profiles == NULL)
+    return;
+
+  printf("%4s %12s %12s %12s %12s %12s %12s %12s %12s %12s %9s %9s %9s %9s %9s\n",
+         "Tile", "Startup", "Downsample", "Auxiliary", "Gating", "Conv", "LB request",
+         "LB sync", "Reduce", "Total", "Requests", "Empty", "Served", "Granted",
+         "Migrated");
+
+  for (int tile=0; tile<profile_tiles; tile++) {
+    const profile_t* p = &profiles[tile];
+
+    // Step 5 is timed as a whole, so take out the load balancing phases to
+    // leave the time spent on convolutions.
+    unsigned long lb = p->cycles[PHASE_LB_REQUEST] + p->cycles[PHASE_LB_SYNC];
+    unsigned long conv = (p->cycles[PHASE_CONV] > lb) ? p->cycles[PHASE_CONV] - lb : 0;
+
+    printf("%4d %12lu %12lu %12lu %12lu %12lu %12lu %12lu %12lu %12lu %9lu %9lu %9lu %9lu %9lu\n",
+           tile, p->cycles[PHASE_STARTUP], p->cycles[PHASE_DOWNSAMPLE], p->cycles[PHASE_AUXILIARY],
+           p->cycles[PHASE_GATING], conv, p->cycles[PHASE_LB_REQUEST],
+           p->cycles[PHASE_LB_SYNC], p->cycles[PHASE_REDUCE],
+           p->cycles[PHASE_TOTAL],
+           p->counts[COUNTER_REQUESTS_SENT], p->counts[COUNTER_EMPTY_RESPONSES],
+           p->counts[COUNTER_REQUESTS_SERVED], p->counts[COUNTER_WORK_GRANTED],
+           p->counts[COUNTER_CHANNELS_MIGRATED]);
+  }
+}
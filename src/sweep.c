@@ -0,0 +1,215 @@
+// Parameter sweeps.
+//
+// A grid file lists the values to try for each parameter, one parameter per
+// line:
+//
+//   in-channels = 32 64 128
+//   mode = simple adaptive gather
+//   tiles = 1 2 4
+//
+// The six positional parameters (in-channels, in-size, in-sparsity,
+// out-channels, out-sparsity, filter-size) must all be given. Any other name
+// is passed on as --name=value. Every combination of values is run in turn,
+// and one line of CSV is written for each: the parameter values, followed by
+// the number of timed runs and their median, minimum and maximum duration.
+// Lines starting with '#' are ignored.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+
+#define MAX_PARAMETERS 24
+#define MAX_VALUES 32
+#define MAX_TEXT 64
+
+// Names of the positional arguments, in order.
+static const char* positional[] = {
+  "in-channels", "in-size", "in-sparsity", "out-channels", "out-sparsity",
+  "filter-size"
+};
+#define NUM_POSITIONAL 6
+
+typedef struct {
+  char name[MAX_TEXT];
+  char values[MAX_VALUES][MAX_TEXT];
+  int num_values;
+
+  // Index in argv, or 0 if this parameter is an option.
+  int position;
+} parameter_t;
+
+typedef struct {
+  parameter_t parameters[MAX_PARAMETERS];
+  int num_parameters;
+} grid_t;
+
+static char* trim(char* text) {
+  while (*text == ' ' || *text == '\t')
+    text++;
+
+  char* end = text + strlen(text);
+  while (end > text && (end[-1] == ' ' || end[-1] == '\t' ||
+                        end[-1] == '\n' || end[-1] == '\r'))
+    *--end = '\0';
+
+  return text;
+}
+
+static void read_grid(const char* filename, grid_t* grid) {
+  FILE* file = fopen(filename, "r");
+  if (file == NULL) {
+    printf("Error: unable to open sweep grid %s\n", filename);
+    exit(1);
+  }
+
+  grid->num_parameters = 0;
+
+  char line[1024];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char* text = trim(line);
+    if (text[0] == '#' || text[0] == '\0')
+      continue;
+
+    char* equals = strchr(text, '=');
+    if (equals == NULL) {
+      printf("Error: expected 'name = values' in %s: %s\n", filename, text);
+      exit(1);
+    }
+    *equals = '\0';
+
+    if (grid->num_parameters == MAX_PARAMETERS) {
+      printf("Error: too many parameters in %s\n", filename);
+      exit(1);
+    }
+
+    parameter_t* parameter = &grid->parameters[grid->num_parameters++];
+    snprintf(parameter->name, MAX_TEXT, "%s", trim(text));
+    parameter->num_values = 0;
+    parameter->position = 0;
+
+    for (int i=0; i<NUM_POSITIONAL; i++)
+      if (!strcmp(parameter->name, positional[i]))
+        parameter->position = i + 1;
+
+    for (char* value = strtok(equals + 1, " \t"); value != NULL;
+         value = strtok(NULL, " \t")) {
+      if (parameter->num_values == MAX_VALUES) {
+        printf("Error: too many values for %s in %s\n", parameter->name, filename);
+        exit(1);
+      }
+      snprintf(parameter->values[parameter->num_values++], MAX_TEXT, "%s", value);
+    }
+
+    if (parameter->num_values == 0) {
+      printf("Error: no values given for %s in %s\n", parameter->name, filename);
+      exit(1);
+    }
+  }
+
+  fclose(file);
+
+  for (int i=0; i<NUM_POSITIONAL; i++) {
+    bool found = false;
+    for (int p=0; p<grid->num_parameters; p++)
+      found |= (grid->parameters[p].position == i + 1);
+
+    if (!found) {
+      printf("Error: sweep grid %s does not give %s\n", filename, positional[i]);
+      exit(1);
+    }
+  }
+}
+
+static int compare_durations(const void* a, const void* b) {
+  unsigned long x = *(const unsigned long*)a;
+  unsigned long y = *(const unsigned long*)b;
+  return (x > y) - (x < y);
+}
+
+void summarise_durations(unsigned long* durations, int count,
+                         unsigned long* median, unsigned long* min,
+                         unsigned long* max) {
+  qsort(durations, count, sizeof(unsigned long), compare_durations);
+
+  *min = durations[0];
+  *max = durations[count - 1];
+  if (count % 2)
+    *median = durations[count / 2];
+  else
+    *median = (durations[count / 2 - 1] + durations[count / 2]) / 2;
+}
+
+void run_sweep(const char* grid_file, const char* csv_file,
+               int num_extra_args, char** extra_args) {
+  grid_t grid;
+  read_grid(grid_file, &grid);
+
+  FILE* csv = stdout;
+  if (csv_file != NULL) {
+    csv = fopen(csv_file, "w");
+    if (csv == NULL) {
+      printf("Error: unable to write %s\n", csv_file);
+      exit(1);
+    }
+  }
+
+  for (int p=0; p<grid.num_parameters; p++)
+    fprintf(csv, "%s,", grid.parameters[p].name);
+  fprintf(csv, "runs,median,min,max\n");
+
+  int num_points = 1;
+  for (int p=0; p<grid.num_parameters; p++)
+    num_points *= grid.parameters[p].num_values;
+
+  // The current value of each parameter. Counts like an odometer, with the
+  // last parameter changing fastest.
+  int choice[MAX_PARAMETERS] = {0};
+
+  char options[MAX_PARAMETERS][2 * MAX_TEXT + 4];
+  char* argv[1 + NUM_POSITIONAL + MAX_PARAMETERS + num_extra_args];
+  unsigned long durations[MAX_REPEATS];
+
+  for (int point=0; point<num_points; point++) {
+    int argc = 1 + NUM_POSITIONAL;
+    argv[0] = "lat-dynamic";
+
+    for (int p=0; p<grid.num_parameters; p++) {
+      parameter_t* parameter = &grid.parameters[p];
+      char* value = parameter->values[choice[p]];
+
+      if (parameter->position > 0)
+        argv[parameter->position] = value;
+      else {
+        snprintf(options[p], sizeof(options[p]), "--%s=%s", parameter->name, value);
+        argv[argc++] = options[p];
+      }
+    }
+
+    for (int i=0; i<num_extra_args; i++)
+      argv[argc++] = extra_args[i];
+
+    printf("Sweep point %d/%d:", point + 1, num_points);
+    for (int i=1; i<argc; i++)
+      printf(" %s", argv[i]);
+    printf("\n");
+
+    int count = run_test(argc, argv, durations);
+    unsigned long median, min, max;
+    summarise_durations(durations, count, &median, &min, &max);
+
+    for (int p=0; p<grid.num_parameters; p++)
+      fprintf(csv, "%s,", grid.parameters[p].values[choice[p]]);
+    fprintf(csv, "%d,%lu,%lu,%lu\n", count, median, min, max);
+    fflush(csv);
+
+    for (int p=grid.num_parameters-1; p>=0; p--) {
+      if (++choice[p] < grid.parameters[p].num_values)
+        break;
+      choice[p] = 0;
+    }
+  }
+
+  if (csv != stdout)
+    fclose(csv);
+}
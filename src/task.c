@@ -1,3 +1,5 @@
+#include <loki/alloc.h>
+#include <loki/channels.h>
 #include <nn/layers.h>
 #include "defs.h"
 
@@ -7,16 +9,17 @@ conv_task_t get_tile_conv_task(const conv_shape_t* shape, int tile, int num_tile
   conv_task_t task;
 
   // Each tile uses all input channels to compute a subset of output channels.
+  // If the channels don't divide evenly, some tiles get one more than others.
 
   task.first_in_channel = 0;
   task.last_in_channel = shape->in_channels;
 
-  int out_channels_per_tile = shape->out_channels / num_tiles;
-  task.first_out_channel = tile * out_channels_per_tile;
-  task.last_out_channel = (tile + 1) * out_channels_per_tile;
+  task.first_out_channel = shape->out_channels * tile / num_tiles;
+  task.last_out_channel = shape->out_channels * (tile + 1) / num_tiles;
 
-  if (task.last_out_channel > shape->out_channels)
-    task.last_out_channel = shape->out_channels;
+  task.first_row = 0;
+  task.last_row = conv_output_rows(shape);
+  task.partial_sums = false;
 
   return task;
 }
@@ -24,12 +27,26 @@ conv_task_t get_tile_conv_task(const conv_shape_t* shape, int tile, int num_tile
 pool_task_t get_tile_pool_task(const pool_shape_t* shape, int tile, int num_tiles) {
   pool_task_t task;
 
-  int channels_per_tile = shape->channels / num_tiles;
-  task.first_channel = tile * channels_per_tile;
-  task.last_channel = (tile + 1) * channels_per_tile;
+  task.first_channel = shape->channels * tile / num_tiles;
+  task.last_channel = shape->channels * (tile + 1) / num_tiles;
 
-  if (task.last_channel > shape->channels)
-    task.last_channel = shape->channels;
+  return task;
+}
+
+pool_task_t get_sparse_pool_task(const sparse_activations_t* tensor,
+                                 const pool_shape_t* shape, int tile,
+                                 int num_tiles) {
+  pool_task_t task;
+
+  // Share the stored channels evenly, then find the dense channels at the
+  // boundaries, so the usual slicing functions can be used.
+  int first = tensor->num_channels * tile / num_tiles;
+  int last = tensor->num_channels * (tile + 1) / num_tiles;
+
+  task.first_channel = (first < tensor->num_channels) ? tensor->channels[first]
+                                                      : shape->channels;
+  task.last_channel = (last < tensor->num_channels) ? tensor->channels[last]
+                                                    : shape->channels;
 
   return task;
 }
@@ -46,28 +63,43 @@ activation_config_t activation_slice(const activation_config_t* tensor,
 
 sparse_activations_t sparse_activation_slice(const sparse_activations_t* tensor,
                                              int first_channel, int last_channel) {
-  // Note: in a real computation, this would be a good opportunity to
-  // redistribute the workload across parallel tiles. I don't do that here
-  // because I'm interested in how well other distribution methods work.
-
-  // Start off assuming there are no channels available.
-  int first_sparse_channel = tensor->num_channels;
-  int num_sparse_channels = 0;
-
-  // Find the first channel index in our given range.
-  for (int i=0; i<tensor->num_channels; i++) {
-    if (tensor->channels[i] >= first_channel) {
-      first_sparse_channel = i;
-      break;
-    }
+  int first_sparse_channel;
+  int num_sparse_channels;
+
+  if (tensor->bitmap != NULL) {
+    // Ranks count channels from the start of the whole tensor, which may be
+    // before this slice. Clamp to the slice.
+    int first = channel_rank(tensor->bitmap, first_channel) - tensor->offset;
+    int last = channel_rank(tensor->bitmap, last_channel) - tensor->offset;
+    if (first < 0)
+      first = 0;
+    if (last > tensor->num_channels)
+      last = tensor->num_channels;
+
+    first_sparse_channel = first;
+    num_sparse_channels = (last > first) ? last - first : 0;
   }
+  else {
+    // No index (see sparse_activations_t): search the channel list.
+    // Start off assuming there are no channels available.
+    first_sparse_channel = tensor->num_channels;
+    num_sparse_channels = 0;
+
+    // Find the first channel index in our given range.
+    for (int i=0; i<tensor->num_channels; i++) {
+      if (tensor->channels[i] >= first_channel) {
+        first_sparse_channel = i;
+        break;
+      }
+    }
 
-  // Count how many channels are in the range.
-  for (int i=first_sparse_channel; i<tensor->num_channels; i++)
-    if (tensor->channels[i] < last_channel)
-      num_sparse_channels++;
-    else
-      break;
+    // Count how many channels are in the range.
+    for (int i=first_sparse_channel; i<tensor->num_channels; i++)
+      if (tensor->channels[i] < last_channel)
+        num_sparse_channels++;
+      else
+        break;
+  }
 
   sparse_activations_t slice = *tensor;
 
@@ -75,21 +107,72 @@ sparse_activations_t sparse_activation_slice(const sparse_activations_t* tensor,
                                  first_sparse_channel + num_sparse_channels);
   slice.channels += first_sparse_channel;
   slice.num_channels = num_sparse_channels;
+  slice.offset += first_sparse_channel;
 
   return slice;
 }
 
 filter_config_t weight_slice(const filter_config_t* tensor,
+                             const weight_blocks_t* blocks,
                              int first_in_channel, int last_in_channel,
                              int first_out_channel, int last_out_channel) {
   filter_config_t slice = *tensor;
+
+  if (blocks != NULL && blocks->block_size > 0) {
+    int size = blocks->block_size;
+    assert(first_in_channel / size == (last_in_channel - 1) / size);
+    assert(first_out_channel / size == (last_out_channel - 1) / size);
+
+    slice.data.address += blocks->in_block_stride * (first_in_channel / size) / sizeof(data_t)
+                        + blocks->out_block_stride * (first_out_channel / size) / sizeof(data_t);
+    first_in_channel %= size;
+    first_out_channel %= size;
+  }
+
   slice.data.address += slice.in_channel_stride * first_in_channel / sizeof(data_t)
                       + slice.out_channel_stride * first_out_channel / sizeof(data_t);
   return slice;
 }
 
+int weight_block_run(const weight_blocks_t* blocks, int channel, int length) {
+  if (blocks == NULL || blocks->block_size == 0)
+    return length;
+
+  int remaining_in_block = blocks->block_size - channel % blocks->block_size;
+  return (length < remaining_in_block) ? length : remaining_in_block;
+}
+
+int conv_output_rows(const conv_shape_t* shape) {
+  return (shape->image_height - shape->filter_height) / shape->stride + 1;
+}
+
+// Bands are made by moving the start of the image and shortening it, so the
+// accelerator doesn't need to know about them.
+
+conv_shape_t get_row_band_shape(const conv_shape_t* shape, int first_row,
+                                int last_row) {
+  conv_shape_t band = *shape;
+  band.image_height = (last_row - first_row - 1) * shape->stride +
+                      shape->filter_height;
+  return band;
+}
+
+activation_config_t input_row_slice(const activation_config_t* tensor,
+                                    const conv_shape_t* shape, int first_row) {
+  activation_config_t slice = *tensor;
+  slice.data.address += slice.column_stride * first_row * shape->stride / sizeof(data_t);
+  return slice;
+}
+
+activation_config_t output_row_slice(const activation_config_t* tensor,
+                                     int first_row) {
+  activation_config_t slice = *tensor;
+  slice.data.address += slice.column_stride * first_row / sizeof(data_t);
+  return slice;
+}
+
 conv_shape_t get_conv_slice(const conv_shape_t* shape, const conv_task_t* task) {
-  conv_shape_t slice = *shape;
+  conv_shape_t slice = get_row_band_shape(shape, task->first_row, task->last_row);
   slice.in_channels = task->last_in_channel - task->first_in_channel;
   slice.out_channels = task->last_out_channel - task->first_out_channel;
   return slice;
@@ -107,7 +190,7 @@ activation_config_t get_output_conv_slice(const activation_config_t* output,
 
 filter_config_t get_weights_conv_slice(const filter_config_t* weights,
                                        const conv_task_t* task) {
-  return weight_slice(weights, task->first_in_channel, task->last_in_channel,
+  return weight_slice(weights, NULL, task->first_in_channel, task->last_in_channel,
                       task->first_out_channel, task->last_out_channel);
 }
 
@@ -147,3 +230,115 @@ sparse_activations_t get_sparse_output_pool_slice(const sparse_activations_t* ou
                                                   const pool_task_t* task) {
   return sparse_activation_slice(output, task->first_channel, task->last_channel);
 }
+
+
+// Channel bitmaps. One word holds 64 channels, and there is always a word
+// beyond the last channel, so the rank of `dense_channels` can be found too.
+
+#define BITMAP_WORD_BITS 64
+
+void init_channel_bitmap(channel_bitmap_t* bitmap, const int* channels,
+                         int num_channels, int dense_channels) {
+  bitmap->num_words = dense_channels / BITMAP_WORD_BITS + 1;
+  bitmap->words = loki_malloc(bitmap->num_words * sizeof(unsigned long long));
+  bitmap->rank = loki_malloc(bitmap->num_words * sizeof(int));
+  assert(bitmap->words != NULL);
+  assert(bitmap->rank != NULL);
+
+  for (int w=0; w<bitmap->num_words; w++)
+    bitmap->words[w] = 0;
+
+  for (int i=0; i<num_channels; i++) {
+    assert(channels[i] >= 0 && channels[i] < dense_channels);
+    bitmap->words[channels[i] / BITMAP_WORD_BITS] |=
+        1ull << (channels[i] % BITMAP_WORD_BITS);
+  }
+
+  int total = 0;
+  for (int w=0; w<bitmap->num_words; w++) {
+    bitmap->rank[w] = total;
+    total += __builtin_popcountll(bitmap->words[w]);
+  }
+
+  // Other tiles slice the same tensor.
+  loki_channel_flush_data(1, bitmap->words,
+                          bitmap->num_words * sizeof(unsigned long long));
+  loki_channel_flush_data(1, bitmap->rank, bitmap->num_words * sizeof(int));
+}
+
+void delete_channel_bitmap(channel_bitmap_t* bitmap) {
+  loki_free(bitmap->words);
+  loki_free(bitmap->rank);
+}
+
+int channel_rank(const channel_bitmap_t* bitmap, int channel) {
+  int word = channel / BITMAP_WORD_BITS;
+  int bit = channel % BITMAP_WORD_BITS;
+
+  if (word >= bitmap->num_words)
+    return bitmap->rank[bitmap->num_words - 1] +
+           __builtin_popcountll(bitmap->words[bitmap->num_words - 1]);
+
+  unsigned long long below = (1ull << bit) - 1;
+  return bitmap->rank[word] + __builtin_popcountll(bitmap->words[word] & below);
+}
+
+
+// Runs of consecutive channels. Finding these once per tensor or task, rather
+// than for every mini-convolution, keeps control costs proportional to the
+// number of runs.
+
+void init_channel_runs(channel_runs_t* runs, const sparse_activations_t* tensor,
+                       int first, int last) {
+  // Worst case: no channels are consecutive.
+  runs->runs = loki_malloc((last > first ? last - first : 1) * sizeof(channel_run_t));
+  assert(runs->runs != NULL);
+  runs->num_runs = 0;
+
+  for (int i=first; i<last; i++) {
+    if (runs->num_runs > 0 &&
+        tensor->channels[i] == tensor->channels[i-1] + 1)
+      runs->runs[runs->num_runs - 1].length++;
+    else {
+      runs->runs[runs->num_runs].first = i;
+      runs->runs[runs->num_runs].length = 1;
+      runs->num_runs++;
+    }
+  }
+}
+
+void delete_channel_runs(channel_runs_t* runs) {
+  loki_free(runs->runs);
+  runs->runs = NULL;
+  runs->num_runs = 0;
+}
+
+void truncate_channel_runs(channel_runs_t* runs, int last) {
+  while (runs->num_runs > 0) {
+    channel_run_t* final = &runs->runs[runs->num_runs - 1];
+
+    if (final->first >= last)
+      runs->num_runs--;
+    else {
+      if (final->first + final->length > last)
+        final->length = last - final->first;
+      break;
+    }
+  }
+}
+
+int find_channel_run(const channel_runs_t* runs, int channel) {
+  // Binary search for the first run which ends after `channel`.
+  int low = 0;
+  int high = runs->num_runs;
+
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (runs->runs[mid].first + runs->runs[mid].length <= channel)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
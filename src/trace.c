@@ -0,0 +1,155 @@
+// Timeline tracing.
+//
+// Each core records events into its own ring buffer, so recording needs no
+// communication. If a buffer fills, the oldest events are overwritten. Every
+// event is stored once it has finished, as a start time and duration, so
+// events lost from the start of a buffer can't leave unmatched begin/end
+// pairs behind.
+//
+// Once computation has finished, tile 0 writes all buffers in Chrome's trace
+// event format, which can be viewed in chrome://tracing or Perfetto. Each
+// tile is a process, and each core a thread. Timestamps are in cycles, but
+// the viewers will show them as microseconds.
+
+#include <stdio.h>
+#include <string.h>
+#include <loki/alloc.h>
+#include <loki/channels.h>
+#include <loki/control_registers.h>
+#include <loki/ids.h>
+#include "defs.h"
+
+// Events kept per core.
+#define TRACE_CAPACITY 4096
+
+#define TRACE_CORES_PER_TILE 2
+
+typedef struct {
+  const char* name;
+  unsigned long start;
+  unsigned long duration;
+  int value;
+  bool instant;
+} trace_event_t;
+
+typedef struct {
+  trace_event_t events[TRACE_CAPACITY];
+  unsigned long count; // Total recorded, including any overwritten.
+} trace_buffer_t;
+
+// One per core, or NULL if tracing is disabled.
+static trace_buffer_t* buffers = NULL;
+static int trace_tiles = 0;
+
+static trace_buffer_t* this_buffer(void) {
+  return &buffers[tile2int(get_tile_id()) * TRACE_CORES_PER_TILE + get_core_id()];
+}
+
+void init_trace(int num_tiles) {
+  trace_tiles = num_tiles;
+  buffers = loki_malloc(num_tiles * TRACE_CORES_PER_TILE * sizeof(trace_buffer_t));
+  assert(buffers != NULL);
+  reset_trace();
+}
+
+void delete_trace(void) {
+  loki_free(buffers);
+  buffers = NULL;
+  trace_tiles = 0;
+}
+
+void reset_trace(void) {
+  if (buffers == NULL)
+    return;
+
+  for (int i=0; i<trace_tiles * TRACE_CORES_PER_TILE; i++)
+    buffers[i].count = 0;
+  loki_channel_flush_data(1, buffers,
+                          trace_tiles * TRACE_CORES_PER_TILE * sizeof(trace_buffer_t));
+}
+
+static void record(const char* name, unsigned long start, unsigned long duration,
+                   int value, bool instant) {
+  trace_buffer_t* buffer = this_buffer();
+  trace_event_t* event = &buffer->events[buffer->count % TRACE_CAPACITY];
+  event->name = name;
+  event->start = start;
+  event->duration = duration;
+  event->value = value;
+  event->instant = instant;
+  buffer->count++;
+}
+
+unsigned long trace_complete(const char* name, unsigned long start, int value) {
+  unsigned long now = get_cycle_count();
+  if (buffers != NULL)
+    record(name, start, now - start, value, false);
+  return now;
+}
+
+void trace_instant(const char* name, int value) {
+  if (buffers != NULL)
+    record(name, get_cycle_count(), 0, value, true);
+}
+
+void flush_trace(void) {
+  if (buffers != NULL)
+    loki_channel_flush_data(1, this_buffer(), sizeof(trace_buffer_t));
+}
+
+void write_trace(const char* filename) {
+  if (buffers == NULL)
+    return;
+
+  FILE* file = fopen(filename, "w");
+  if (file == NULL) {
+    printf("Warning: unable to write trace to %s\n", filename);
+    return;
+  }
+
+  // Start the timeline at the earliest event.
+  unsigned long origin = ~0ul;
+  for (int i=0; i<trace_tiles * TRACE_CORES_PER_TILE; i++) {
+    const trace_buffer_t* buffer = &buffers[i];
+    unsigned long first = (buffer->count > TRACE_CAPACITY) ? buffer->count - TRACE_CAPACITY : 0;
+    for (unsigned long e=first; e<buffer->count; e++)
+      if (buffer->events[e % TRACE_CAPACITY].start < origin)
+        origin = buffer->events[e % TRACE_CAPACITY].start;
+  }
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  bool first_event = true;
+
+  for (int tile=0; tile<trace_tiles; tile++) {
+    fprintf(file, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"Tile %d\"}}", first_event ? "" : ",\n", tile, tile);
+    first_event = false;
+
+    for (int core=0; core<TRACE_CORES_PER_TILE; core++) {
+      const trace_buffer_t* buffer = &buffers[tile * TRACE_CORES_PER_TILE + core];
+
+      fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+              "\"args\":{\"name\":\"Core %d\"}}", tile, core, core);
+
+      if (buffer->count > TRACE_CAPACITY)
+        printf("Warning: tile %d core %d lost %lu trace events\n", tile, core,
+               buffer->count - TRACE_CAPACITY);
+
+      unsigned long first = (buffer->count > TRACE_CAPACITY) ? buffer->count - TRACE_CAPACITY : 0;
+      for (unsigned long e=first; e<buffer->count; e++) {
+        const trace_event_t* event = &buffer->events[e % TRACE_CAPACITY];
+
+        fprintf(file, ",\n{\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%lu,",
+                event->name, tile, core, event->start - origin);
+        if (event->instant)
+          fprintf(file, "\"ph\":\"i\",\"s\":\"t\",");
+        else
+          fprintf(file, "\"ph\":\"X\",\"dur\":%lu,", event->duration);
+        fprintf(file, "\"args\":{\"value\":%d}}", event->value);
+      }
+    }
+  }
+
+  fprintf(file, "\n]}\n");
+  fclose(file);
+}
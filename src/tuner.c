@@ -0,0 +1,360 @@
+// Loop nest autotuning.
+//
+// The best loop order for the accelerator depends on the shape of each
+// convolution. Tuned loop nests are kept in a text file, one shape per line:
+//
+//   batch in out width height filter_width filter_height stride: loop loop ...
+//
+// where each loop is an `enum Loop` value. The file is read before computation
+// starts, and lookups during computation are read-only. If tuning is enabled,
+// each tile notes the shapes it could not find, and once computation has
+// finished, tile 0 times every candidate loop nest for each of them and
+// rewrites the file.
+
+#include <stdio.h>
+#include <loki/alloc.h>
+#include <nn/layers.h>
+#include "defs.h"
+
+// Loops needed for a convolution with batch size 1.
+#define NEST_LOOPS 6
+
+// Hash table of tuned shapes. Must be a power of two.
+#define TABLE_SIZE 512
+
+// Untuned shapes recorded by each tile.
+#define MAX_UNTUNED 64
+
+#define TIMING_REPEATS 3
+
+typedef struct {
+  bool valid;
+  conv_shape_t shape;
+  enum Loop loops[NEST_LOOPS];
+  loop_nest_t nest;
+} tuned_nest_t;
+
+static tuned_nest_t table[TABLE_SIZE];
+static int table_entries = 0;
+
+typedef struct {
+  conv_shape_t shapes[MAX_UNTUNED];
+  int count;
+} untuned_t;
+
+// One per tile, or NULL if tuning is disabled.
+static untuned_t* untuned = NULL;
+static int untuned_tiles = 0;
+
+static bool same_shape(const conv_shape_t* a, const conv_shape_t* b) {
+  return a->batch_size == b->batch_size &&
+         a->in_channels == b->in_channels &&
+         a->out_channels == b->out_channels &&
+         a->image_width == b->image_width &&
+         a->image_height == b->image_height &&
+         a->filter_width == b->filter_width &&
+         a->filter_height == b->filter_height &&
+         a->stride == b->stride &&
+         a->groups == b->groups &&
+         a->dilation == b->dilation;
+}
+
+static unsigned int hash_shape(const conv_shape_t* shape) {
+  unsigned int hash = shape->in_channels;
+  hash = hash * 31 + shape->out_channels;
+  hash = hash * 31 + shape->image_width;
+  hash = hash * 31 + shape->image_height;
+  hash = hash * 31 + shape->filter_width;
+  hash = hash * 31 + shape->filter_height;
+  return hash;
+}
+
+// Return the table entry for `shape`, or the empty slot where it would go.
+static tuned_nest_t* find_entry(const conv_shape_t* shape) {
+  unsigned int slot = hash_shape(shape) & (TABLE_SIZE - 1);
+
+  while (table[slot].valid && !same_shape(&table[slot].shape, shape))
+    slot = (slot + 1) & (TABLE_SIZE - 1);
+
+  return &table[slot];
+}
+
+static void add_entry(const conv_shape_t* shape, const enum Loop* loops) {
+  tuned_nest_t* entry = find_entry(shape);
+
+  if (!entry->valid) {
+    // Keep one slot empty so that searches terminate.
+    if (table_entries == TABLE_SIZE - 1) {
+      printf("Warning: loop nest cache is full\n");
+      return;
+    }
+    table_entries++;
+  }
+
+  entry->valid = true;
+  entry->shape = *shape;
+  for (int l=0; l<NEST_LOOPS; l++)
+    entry->loops[l] = loops[l];
+  entry->nest.loop_count = NEST_LOOPS;
+  entry->nest.loops = entry->loops;
+}
+
+const loop_nest_t* tuned_loop_nest(const conv_shape_t* shape,
+                                   const loop_nest_t* fallback) {
+  tuned_nest_t* entry = find_entry(shape);
+  if (entry->valid)
+    return &entry->nest;
+
+  if (untuned != NULL) {
+    untuned_t* list = &untuned[tile2int(get_tile_id())];
+
+    bool seen = false;
+    for (int i=0; i<list->count && !seen; i++)
+      seen = same_shape(&list->shapes[i], shape);
+
+    if (!seen && list->count < MAX_UNTUNED)
+      list->shapes[list->count++] = *shape;
+  }
+
+  return fallback;
+}
+
+void load_loop_nests(const char* filename) {
+  FILE* file = fopen(filename, "r");
+  if (file == NULL)
+    return;
+
+  char line[256];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (line[0] == '#')
+      continue;
+
+    conv_shape_t shape;
+    int loops[NEST_LOOPS];
+    int fields = sscanf(line, "%d %d %d %d %d %d %d %d: %d %d %d %d %d %d",
+                        &shape.batch_size, &shape.in_channels, &shape.out_channels,
+                        &shape.image_width, &shape.image_height,
+                        &shape.filter_width, &shape.filter_height, &shape.stride,
+                        &loops[0], &loops[1], &loops[2], &loops[3], &loops[4],
+                        &loops[5]);
+    if (fields != 8 + NEST_LOOPS) {
+      printf("Warning: ignoring malformed line in %s: %s", filename, line);
+      continue;
+    }
+
+    // A stale or edited file could name loops which don't exist.
+    bool valid = true;
+    for (int l=0; l<NEST_LOOPS; l++)
+      valid &= (loops[l] >= BATCH && loops[l] <= FILTER_HEIGHT_OS);
+    if (!valid) {
+      printf("Warning: ignoring unknown loop in %s: %s", filename, line);
+      continue;
+    }
+
+    shape.groups = 1;
+    shape.dilation = 1;
+
+    enum Loop nest[NEST_LOOPS];
+    for (int l=0; l<NEST_LOOPS; l++)
+      nest[l] = (enum Loop)loops[l];
+    add_entry(&shape, nest);
+  }
+
+  fclose(file);
+}
+
+static void save_loop_nests(const char* filename) {
+  FILE* file = fopen(filename, "w");
+  if (file == NULL) {
+    printf("Warning: unable to write loop nests to %s\n", filename);
+    return;
+  }
+
+  fprintf(file, "# batch in out width height filter_width filter_height stride: loops\n");
+  for (int slot=0; slot<TABLE_SIZE; slot++) {
+    const tuned_nest_t* entry = &table[slot];
+    if (!entry->valid)
+      continue;
+
+    const conv_shape_t* s = &entry->shape;
+    fprintf(file, "%d %d %d %d %d %d %d %d:", s->batch_size, s->in_channels,
+            s->out_channels, s->image_width, s->image_height, s->filter_width,
+            s->filter_height, s->stride);
+    for (int l=0; l<NEST_LOOPS; l++)
+      fprintf(file, " %d", entry->loops[l]);
+    fprintf(file, "\n");
+  }
+
+  fclose(file);
+}
+
+void record_untuned_shapes(int num_tiles) {
+  untuned = loki_malloc(num_tiles * sizeof(untuned_t));
+  assert(untuned != NULL);
+  untuned_tiles = num_tiles;
+
+  for (int tile=0; tile<num_tiles; tile++)
+    untuned[tile].count = 0;
+}
+
+
+// Tuning.
+
+unsigned long time_conv(const conv_shape_t* shape, const loop_nest_t* loop_nest) {
+  int out_width = shape->image_width - shape->filter_width + 1;
+  int out_height = shape->image_height - shape->filter_height + 1;
+  channel_t mem_group_cpu = get_channel_map(1);
+
+  // Same layouts as the sparse modes.
+  sparse_activations_t input, output;
+  init_sparse(&input, 1, shape->in_channels, shape->image_height, shape->image_width);
+  init_sparse(&output, 1, shape->out_channels, out_height, out_width);
+  input.dense.data.address = loki_malloc(shape->in_channels * shape->image_width *
+                                         shape->image_height * sizeof(data_t));
+  output.dense.data.address = loki_malloc(shape->out_channels * out_width *
+                                          out_height * sizeof(data_t));
+  input.dense.data.memory_config = mem_group_cpu;
+  output.dense.data.memory_config = mem_group_cpu;
+
+  filter_config_t weights;
+  init_weights_sparse(&weights, shape->in_channels, shape->out_channels,
+                      shape->filter_height, shape->filter_width);
+  weights.data.address = loki_malloc(shape->in_channels * shape->out_channels *
+                                     shape->filter_width * shape->filter_height *
+                                     sizeof(data_t));
+  weights.data.memory_config = mem_group_cpu;
+
+  assert(input.dense.data.address != NULL);
+  assert(output.dense.data.address != NULL);
+  assert(weights.data.address != NULL);
+
+  unsigned long best = ~0ul;
+  for (int repeat=0; repeat<TIMING_REPEATS; repeat++) {
+    unsigned long start = get_cycle_count();
+    lat_conv2d(&input.dense, &weights, &output.dense, shape, loop_nest);
+    unsigned long duration = get_cycle_count() - start;
+    if (duration < best)
+      best = duration;
+  }
+
+  loki_free(input.dense.data.address);
+  loki_free(output.dense.data.address);
+  loki_free(weights.data.address);
+
+  return best;
+}
+
+static int loop_extent(const conv_shape_t* shape, enum Loop loop) {
+  switch (loop) {
+    case BATCH: return shape->batch_size;
+    case IN_CHANNELS: return shape->in_channels;
+    case OUT_CHANNELS: return shape->out_channels;
+    case IMAGE_WIDTH: return shape->image_width - shape->filter_width + 1;
+    case IMAGE_HEIGHT: return shape->image_height - shape->filter_height + 1;
+    case FILTER_WIDTH_IS:
+    case FILTER_WIDTH_OS: return shape->filter_width;
+    case FILTER_HEIGHT_IS:
+    case FILTER_HEIGHT_OS: return shape->filter_height;
+    default: return 1;
+  }
+}
+
+typedef struct {
+  const conv_shape_t* shape;
+  enum Loop best[NEST_LOOPS];
+  unsigned long best_cycles;
+  int candidates;
+} search_t;
+
+// Time one candidate. The accelerator parallelises the two innermost loops,
+// so orders which put a loop of extent 1 there are skipped.
+static void try_nest(search_t* search, enum Loop* loops) {
+  if (loop_extent(search->shape, loops[NEST_LOOPS-1]) == 1 ||
+      loop_extent(search->shape, loops[NEST_LOOPS-2]) == 1)
+    return;
+
+  loop_nest_t nest = {.loop_count = NEST_LOOPS, .loops = loops};
+  unsigned long cycles = time_conv(search->shape, &nest);
+  search->candidates++;
+
+  if (cycles < search->best_cycles) {
+    search->best_cycles = cycles;
+    for (int l=0; l<NEST_LOOPS; l++)
+      search->best[l] = loops[l];
+  }
+}
+
+// Try every ordering of loops[first..], with each choice of input/output
+// stationary filter loops.
+static void permute(search_t* search, enum Loop* loops, int first) {
+  if (first == NEST_LOOPS) {
+    enum Loop variant[NEST_LOOPS];
+    for (int filter_variants=0; filter_variants<4; filter_variants++) {
+      for (int l=0; l<NEST_LOOPS; l++) {
+        variant[l] = loops[l];
+        if (loops[l] == FILTER_WIDTH_IS && (filter_variants & 1))
+          variant[l] = FILTER_WIDTH_OS;
+        if (loops[l] == FILTER_HEIGHT_IS && (filter_variants & 2))
+          variant[l] = FILTER_HEIGHT_OS;
+      }
+      try_nest(search, variant);
+    }
+    return;
+  }
+
+  for (int l=first; l<NEST_LOOPS; l++) {
+    enum Loop temp = loops[first];
+    loops[first] = loops[l];
+    loops[l] = temp;
+
+    permute(search, loops, first + 1);
+
+    loops[l] = loops[first];
+    loops[first] = temp;
+  }
+}
+
+static void tune_shape(const conv_shape_t* shape) {
+  enum Loop loops[NEST_LOOPS] = {OUT_CHANNELS, IN_CHANNELS, IMAGE_HEIGHT,
+                                 IMAGE_WIDTH, FILTER_HEIGHT_IS, FILTER_WIDTH_IS};
+
+  search_t search;
+  search.shape = shape;
+  search.best_cycles = ~0ul;
+  search.candidates = 0;
+  permute(&search, loops, 0);
+
+  // Every order was skipped: the shape is too small to parallelise, so any
+  // order will do.
+  if (search.candidates == 0)
+    for (int l=0; l<NEST_LOOPS; l++)
+      search.best[l] = loops[l];
+
+  add_entry(shape, search.best);
+}
+
+void tune_loop_nests(const char* filename) {
+  assert(untuned != NULL);
+  int tuned = 0;
+
+  for (int tile=0; tile<untuned_tiles; tile++) {
+    for (int i=0; i<untuned[tile].count; i++) {
+      const conv_shape_t* shape = &untuned[tile].shapes[i];
+
+      // Several tiles may have seen the same shape.
+      if (find_entry(shape)->valid)
+        continue;
+
+      tune_shape(shape);
+      tuned++;
+    }
+  }
+
+  loki_free(untuned);
+  untuned = NULL;
+
+  if (tuned > 0) {
+    save_loop_nests(filename);
+    printf("Tuned loop nests for %d new shapes\n", tuned);
+  }
+}